@@ -1,4 +1,7 @@
 #include "flashsearch.h"
+#include <ftw.h>
+#include <getopt.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,54 +11,579 @@
 #include <unistd.h>
 #include <sys/mman.h>
 
-void *load_file(const char *fname, size_t *sz) {
-    int fd = open(fname, O_RDONLY);
-    if (fd < 0) return NULL;
+void make_data(const char *fname, long num, double zipf, int t) {
+    printf("Making %ldM records with %d th...\n", num / 1000000, t);
+    
+    static const char *plants[] = {"fs-plant-early", "fs-plant-middle", "fs-plant-late"};
+    
+    FsGen g;
+    flashsearch_gen_init(&g, num);
+    g.zipf = zipf;
+    g.nplant = 3;
+    for (int k = 0; k < g.nplant; k++) {
+        g.plant[k] = plants[k];
+        g.plant_rec[k] = num / 10 + (num - num / 5) / 2 * k;
+    }
     
-    struct stat st;
-    if (fstat(fd, &st) < 0) {
-        close(fd);
-        return NULL;
+    struct timespec s, e;
+    clock_gettime(CLOCK_MONOTONIC, &s);
+    
+    if (flashsearch_generate(&g, fname, t) != 0) {
+        printf("Can't make %s\n", fname);
+        return;
+    }
+    
+    clock_gettime(CLOCK_MONOTONIC, &e);
+    double ms = (e.tv_sec - s.tv_sec) * 1000.0 + (e.tv_nsec - s.tv_nsec) / 1e6;
+    printf("File: %s (%.2f GB) in %.0f ms, %.1f GB/s\n", fname, g.bytes / 1e9, ms,
+           ms > 0 ? g.bytes / (ms / 1000.0) / 1e9 : 0);
+    
+    FsFile *ff = flashsearch_open_file(fname, 0, t);
+    size_t l = 0;
+    const char *d = flashsearch_file_data(ff, &l);
+    
+    int ok = 0;
+    for (int k = 0; ff && k < g.nplant; k++) {
+        size_t *hits = NULL;
+        long n = flashsearch_find_all(NULL, d, l, plants[k], strlen(plants[k]), t, &hits, NULL);
+        ok += n == 1 && hits[0] == g.plant_off[k];
+        free(hits);
+    }
+    flashsearch_close_file(ff);
+    
+    printf("Planted: %d/%d at known offsets\n\n", ok, g.nplant);
+}
+
+int cmp_size(const void *a, const void *b) {
+    size_t x = *(const size_t*)a, y = *(const size_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+int seam_round(char *d, const char *orig, size_t l, int t, unsigned *seed) {
+    char p[64];
+    size_t pl = 2 + rand_r(seed) % 63;
+    for (size_t k = 0; k < pl; k++) p[k] = 'A' + rand_r(seed) % 26;
+    
+    size_t nb = l / 4096 + t;
+    size_t *bs = malloc(nb * sizeof(size_t));
+    size_t *at = malloc(nb * sizeof(size_t));
+    FsPool *pool = flashsearch_pool_create(t);
+    if (!bs || !at || !pool) {
+        free(bs);
+        free(at);
+        flashsearch_pool_destroy(pool);
+        return 0;
+    }
+    
+    nb = 0;
+    for (size_t b = 4096; b < l; b += 4096) bs[nb++] = b;
+    for (int i = 1; i < t; i++) bs[nb++] = i * (l / t);
+    qsort(bs, nb, sizeof(size_t), cmp_size);
+    
+    size_t n = 0;
+    for (size_t k = 0; k < nb; k++) {
+        size_t o = 1 + rand_r(seed) % (pl - 1);
+        if (bs[k] < o || bs[k] - o + pl > l) continue;
+        if (n && bs[k] - o < at[n - 1] + pl) continue;
+        at[n] = bs[k] - o;
+        memcpy(d + at[n], p, pl);
+        n++;
+    }
+    
+    int fails = 0;
+    
+    size_t *hits = NULL;
+    long nh = flashsearch_find_all(NULL, d, l, p, pl, t, &hits, NULL);
+    if (nh != (long)n || memcmp(hits, at, n * sizeof(size_t))) fails++;
+    free(hits);
+    
+    for (size_t k = 0; k < n; k++) {
+        const char *r = flashsearch_hyper_pool(pool, d, l, p, pl, NULL);
+        if (r != d + at[k]) fails++;
+        memcpy(d + at[k], orig + at[k], pl);
+    }
+    
+    flashsearch_pool_destroy(pool);
+    free(bs);
+    free(at);
+    return fails;
+}
+
+int check_seams(int maxth) {
+    printf("=== SEAM CHECK ===\n");
+    
+    unsigned seed = 12345;
+    size_t l = 512 * 1024 + rand_r(&seed) % 4096;
+    char *d = malloc(l);
+    char *orig = malloc(l);
+    if (!d || !orig) {
+        free(d);
+        free(orig);
+        printf("Can't allocate\n\n");
+        return 1;
+    }
+    
+    for (size_t i = 0; i < l; i++) d[i] = 'a' + rand_r(&seed) % 26;
+    memcpy(orig, d, l);
+    
+    int fails = 0;
+    for (int t = 1; t <= maxth; t++) {
+        fails += seam_round(d, orig, l, t, &seed);
     }
     
-    *sz = st.st_size;
-    void *addr = mmap(NULL, *sz, PROT_READ, MAP_PRIVATE, fd, 0);
-    close(fd);
+    printf("Boundaries: every 4KB and thread edge, 1..%d threads, %s (%d missed)\n\n",
+           maxth, fails ? "FAIL" : "OK", fails);
     
-    return addr != MAP_FAILED ? addr : NULL;
+    free(d);
+    free(orig);
+    return fails;
+}
+
+#define BENCH_FIRST 0
+#define BENCH_ALL 1
+#define BENCH_MULTI 2
+#define BENCH_BATCH 3
+#define BENCH_REGEX 4
+#define BENCH_TREE 5
+
+#define BENCH_WARM 1
+#define BENCH_COLD 2
+
+typedef struct {
+    int warmup;
+    int reps;
+    int modes;
+    int sweep;
+    int gen;
+    int maxth;
+    long records;
+    double zipf;
+    size_t size;
+    const char *fname;
+    const char *csv;
+    const char *json;
+    const char *tree;
+    int seams;
+} BenchOpts;
+
+typedef struct {
+    const char *suite;
+    const char *name;
+    int op;
+    const char *d;
+    size_t l;
+    const char *p;
+    size_t pl;
+    void *obj;
+    int nobj;
+    int t;
+    double pos;
+    double density;
+} BenchCase;
+
+typedef struct {
+    const char *suite;
+    char name[48];
+    int op;
+    size_t pl;
+    double pos;
+    double density;
+    int t;
+    int cold;
+    int n;
+    long hits;
+    size_t need;
+    double median, p99, mean, sd, lo, hi, min, max;
+    double gbps;
+    unsigned long long cand;
+} BenchRow;
+
+BenchOpts bo = {1, 5, BENCH_WARM, 0, 0, 16, 10000000, 0, 256, "data.json", NULL, NULL, NULL, 0};
+
+BenchRow *rows;
+int nrows, caprows;
+
+const char *cold_map;
+size_t cold_len;
+int cold_fd = -1;
+
+char *evict_buf;
+size_t evict_len;
+
+const char *op_name(int op) {
+    static const char *ns[] = {"first", "all", "multi", "batch", "regex", "tree"};
+    return ns[op];
+}
+
+double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+void evict_cache(void) {
+    if (!evict_buf) {
+        long l3 = sysconf(_SC_LEVEL3_CACHE_SIZE);
+        evict_len = (l3 > 0 ? (size_t)l3 : 32 << 20) * 4;
+        evict_buf = malloc(evict_len);
+        if (!evict_buf) return;
+    }
+    
+    volatile char *v = evict_buf;
+    for (size_t i = 0; i < evict_len; i += 64) v[i] = (char)i;
+}
+
+int drop_file(const char *path, const struct stat *st, int ty, struct FTW *fw) {
+    (void)fw;
+    if (ty != FTW_F || !S_ISREG(st->st_mode)) return 0;
+    
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+    return 0;
+}
+
+void go_cold(const BenchCase *c) {
+    if (cold_map && c->d == cold_map) {
+        madvise((void*)cold_map, cold_len, MADV_DONTNEED);
+        if (cold_fd >= 0) posix_fadvise(cold_fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+    if (c->op == BENCH_TREE) nftw(c->d, drop_file, 64, FTW_PHYS);
+    evict_cache();
+}
+
+long bench_once(const BenchCase *c, size_t *need, Context *ctx) {
+    *need = c->l;
+    
+    switch (c->op) {
+    case BENCH_FIRST: {
+        const char *r = flashsearch_hyper(c->d, c->l, c->p, c->pl, c->t, ctx);
+        if (r) *need = r - c->d + c->pl;
+        return r != NULL;
+    }
+    case BENCH_ALL: {
+        size_t *v = NULL;
+        long n = flashsearch_find_all(NULL, c->d, c->l, c->p, c->pl, c->t, &v, ctx);
+        free(v);
+        return n;
+    }
+    case BENCH_MULTI: {
+        FsMatch *v = NULL;
+        long n = flashsearch_multi_all(c->obj, NULL, c->d, c->l, c->t, &v, ctx);
+        free(v);
+        return n;
+    }
+    case BENCH_BATCH: {
+        FsJob *js = c->obj;
+        int n = flashsearch_batch(NULL, c->d, c->l, js, c->nobj, c->t, ctx);
+        if (n == c->nobj && n > 0) {
+            *need = 0;
+            for (int j = 0; j < n; j++) {
+                size_t e = js[j].result - c->d + js[j].pattern_len;
+                if (e > *need) *need = e;
+            }
+        }
+        return n;
+    }
+    case BENCH_TREE: {
+        FsTree *tr = c->obj;
+        long n = flashsearch_tree(NULL, c->d, c->p, c->pl, tr, c->t, NULL, NULL, ctx);
+        *need = tr->bytes;
+        return n;
+    }
+    default: {
+        size_t ml = 0;
+        const char *r = flashsearch_regex_find(c->obj, NULL, c->d, c->l, c->t, &ml, ctx);
+        if (r) *need = r - c->d + ml;
+        return r != NULL;
+    }
+    }
 }
 
-void unload_file(void *a, size_t s) {
-    if (a) munmap(a, s);
+int cmp_double(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
 }
 
-void make_data(const char *fname, long num) {
-    printf("Making %ldM records...\n", num / 1000000);
+void summarize(BenchRow *r, double *v, int n) {
+    qsort(v, n, sizeof(double), cmp_double);
+    
+    double s = 0, q = 0;
+    for (int i = 0; i < n; i++) s += v[i];
+    r->mean = s / n;
+    for (int i = 0; i < n; i++) q += (v[i] - r->mean) * (v[i] - r->mean);
+    r->sd = n > 1 ? sqrt(q / (n - 1)) : 0;
     
-    FILE *f = fopen(fname, "w");
-    if (!f) return;
+    r->median = n & 1 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
     
-    setvbuf(f, NULL, _IOFBF, 65536);
+    int k = (int)ceil(0.99 * n) - 1;
+    r->p99 = v[k < 0 ? 0 : k];
     
-    fprintf(f, "[\n");
+    double h = 0.98 * sqrt(n);
+    int lo = (int)floor(n / 2.0 - h);
+    int hi = (int)ceil(n / 2.0 + h);
+    r->lo = v[lo < 0 ? 0 : lo];
+    r->hi = v[hi > n - 1 ? n - 1 : hi];
     
-    for (long i = 0; i < num; i++) {
-        fprintf(f, "{\"id\":%ld,\"key\":\"key%08ld\",\"value\":%ld,\"tag\":\"tag%04ld\"}",
-                i, i, i * 3, i % 10000);
+    r->min = v[0];
+    r->max = v[n - 1];
+    r->n = n;
+}
+
+BenchRow *bench_row(void) {
+    static BenchRow spare;
+    
+    if (nrows + 2 > caprows) {
+        int nc = caprows ? caprows * 2 : 64;
+        BenchRow *nv = realloc(rows, nc * sizeof(BenchRow));
+        if (!nv) return &spare;
+        rows = nv;
+        caprows = nc;
+    }
+    return &rows[nrows++];
+}
+
+const BenchRow *measure(const BenchCase *c, const char *label) {
+    int n = bo.reps > 0 ? bo.reps : 1;
+    double *v = malloc(n * sizeof(double));
+    if (!v) return NULL;
+    
+    const BenchRow *first = NULL;
+    
+    for (int m = BENCH_WARM; m <= BENCH_COLD; m <<= 1) {
+        if (!(bo.modes & m)) continue;
+        
+        BenchRow *r = bench_row();
+        memset(r, 0, sizeof(*r));
+        r->suite = c->suite;
+        snprintf(r->name, sizeof(r->name), "%s", c->name);
+        r->op = c->op;
+        r->pl = c->pl;
+        r->pos = c->pos;
+        r->density = c->density;
+        r->t = c->t;
+        r->cold = m == BENCH_COLD;
         
-        if (i < num - 1) fprintf(f, ",\n");
+        Context ctx;
+        size_t need = c->l;
         
-        if (i % (num / 10) == 0 && i > 0) {
-            printf("  Made %ldM\n", i / 1000000);
+        for (int i = 0; i < bo.warmup; i++) bench_once(c, &need, &ctx);
+        
+        for (int i = 0; i < n; i++) {
+            if (r->cold) go_cold(c);
+            double t0 = now_ms();
+            r->hits = bench_once(c, &need, &ctx);
+            v[i] = now_ms() - t0;
         }
+        
+        summarize(r, v, n);
+        r->need = need;
+        r->gbps = r->median > 0 ? need / (r->median / 1000.0) / 1e9 : 0;
+        r->cand = ctx.stats.sum.candidates;
+        
+        printf("%s%s %8.2f ms [%.2f..%.2f] p99 %8.2f, %5.1f GB/s\n",
+               label, r->cold ? "cold" : "warm", r->median, r->lo, r->hi, r->p99, r->gbps);
+        
+        if (!first) first = r;
+    }
+    
+    free(v);
+    return first;
+}
+
+void write_csv(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        printf("Can't write %s\n", path);
+        return;
+    }
+    
+    fprintf(f, "suite,name,op,pattern_len,pos,density,threads,mode,reps,hits,bytes,"
+               "median_ms,p99_ms,mean_ms,sd_ms,ci_lo_ms,ci_hi_ms,min_ms,max_ms,gbps,candidates\n");
+    
+    for (int i = 0; i < nrows; i++) {
+        const BenchRow *r = &rows[i];
+        fprintf(f, "%s,%s,%s,%zu,%.4f,%.1f,%d,%s,%d,%ld,%zu,"
+                   "%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.3f,%llu\n",
+                r->suite, r->name, op_name(r->op), r->pl, r->pos, r->density, r->t,
+                r->cold ? "cold" : "warm", r->n, r->hits, r->need,
+                r->median, r->p99, r->mean, r->sd, r->lo, r->hi, r->min, r->max,
+                r->gbps, r->cand);
     }
     
-    fprintf(f, "\n]\n");
     fclose(f);
+    printf("CSV: %s (%d rows)\n", path, nrows);
+}
+
+void write_json(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        printf("Can't write %s\n", path);
+        return;
+    }
     
-    struct stat st;
-    stat(fname, &st);
-    printf("File: %s (%.2f GB)\n\n", fname, st.st_size / 1e9);
+    fprintf(f, "{\"warmup\":%d,\"reps\":%d,\"kernel\":%d,\"results\":[",
+            bo.warmup, bo.reps, flashsearch_kernel());
+    
+    for (int i = 0; i < nrows; i++) {
+        const BenchRow *r = &rows[i];
+        fprintf(f, "%s\n{\"suite\":\"%s\",\"name\":\"%s\",\"op\":\"%s\",\"pattern_len\":%zu,"
+                   "\"pos\":%.4f,\"density\":%.1f,\"threads\":%d,\"mode\":\"%s\",\"reps\":%d,"
+                   "\"hits\":%ld,\"bytes\":%zu,\"median_ms\":%.4f,\"p99_ms\":%.4f,"
+                   "\"mean_ms\":%.4f,\"sd_ms\":%.4f,\"ci_lo_ms\":%.4f,\"ci_hi_ms\":%.4f,"
+                   "\"min_ms\":%.4f,\"max_ms\":%.4f,\"gbps\":%.3f,\"candidates\":%llu}",
+                i ? "," : "", r->suite, r->name, op_name(r->op), r->pl,
+                r->pos, r->density, r->t, r->cold ? "cold" : "warm", r->n,
+                r->hits, r->need, r->median, r->p99,
+                r->mean, r->sd, r->lo, r->hi,
+                r->min, r->max, r->gbps, r->cand);
+    }
+    
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    printf("JSON: %s (%d rows)\n", path, nrows);
+}
+
+uint64_t sweep_hash(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+void sweep_fill(char *d, size_t a, size_t b) {
+    static const char al[] = "etaoinshrdlucmfwypvbgkjqxz  ,.\n\"";
+    
+    for (size_t i = a; i < b;) {
+        uint64_t x = sweep_hash(i / 8);
+        for (size_t k = i % 8; k < 8 && i < b; k++, i++) d[i] = al[(x >> (k * 8)) & 31];
+    }
+}
+
+void run_sweep(int maxth) {
+    size_t l = bo.size << 20;
+    char *d = malloc(l);
+    if (!d) {
+        printf("No memory for sweep\n");
+        return;
+    }
+    sweep_fill(d, 0, l);
+    
+    char p[1024];
+    for (size_t k = 0; k < sizeof(p); k++) p[k] = 'a' + sweep_hash(~k) % 26;
+    
+    printf("=== SWEEP ===\n");
+    printf("Data: %zu MB synthetic, %d warmup, %d reps\n\n", bo.size, bo.warmup, bo.reps);
+    
+    char name[48], label[64];
+    BenchCase c = {"sweep", name, BENCH_FIRST, d, l, p, 16, NULL, 0, maxth, -1, 0};
+    
+    printf("Pattern length (no match, %d th)\n", maxth);
+    size_t lens[] = {2, 4, 8, 16, 32, 64, 256, 1024};
+    for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+        char z = p[lens[i] - 1];
+        p[lens[i] - 1] = '#';
+        
+        c.pl = lens[i];
+        snprintf(name, sizeof(name), "len%zu", lens[i]);
+        snprintf(label, sizeof(label), "  %5zu B: ", lens[i]);
+        measure(&c, label);
+        
+        p[lens[i] - 1] = z;
+    }
+    
+    printf("\nMatch position (16 B, %d th)\n", maxth);
+    c.pl = 16;
+    double poss[] = {0.001, 0.1, 0.25, 0.5, 0.75, 0.99};
+    for (size_t i = 0; i < sizeof(poss) / sizeof(poss[0]); i++) {
+        size_t at = (size_t)(poss[i] * (l - c.pl));
+        memcpy(d + at, p, c.pl);
+        
+        c.pos = poss[i];
+        snprintf(name, sizeof(name), "pos%.3f", poss[i]);
+        snprintf(label, sizeof(label), "  %5.1f%%: ", poss[i] * 100);
+        measure(&c, label);
+        
+        sweep_fill(d, at, at + c.pl);
+    }
+    
+    printf("\nHit density (find all, 16 B, %d th)\n", maxth);
+    c.op = BENCH_ALL;
+    c.pos = -1;
+    int dens[] = {0, 1, 16, 256, 4096};
+    for (size_t i = 0; i < sizeof(dens) / sizeof(dens[0]); i++) {
+        size_t k = (size_t)dens[i] * (l >> 20);
+        size_t st = k ? l / k : l;
+        for (size_t j = 0; j < k; j++) memcpy(d + j * st, p, c.pl);
+        
+        c.density = dens[i];
+        snprintf(name, sizeof(name), "dens%d", dens[i]);
+        snprintf(label, sizeof(label), "  %4d/MB: ", dens[i]);
+        measure(&c, label);
+        
+        for (size_t j = 0; j < k; j++) sweep_fill(d, j * st, j * st + c.pl);
+    }
+    
+    printf("\nThreads (no match, 16 B)\n");
+    c.op = BENCH_FIRST;
+    c.density = 0;
+    for (int th = 1;; th *= 2) {
+        if (th > maxth) th = maxth;
+        c.t = th;
+        snprintf(name, sizeof(name), "th%d", th);
+        snprintf(label, sizeof(label), "  %2d th: ", th);
+        measure(&c, label);
+        if (th == maxth) break;
+    }
+    
+    printf("\n");
+    free(d);
+}
+
+void run_tree(const char *root, int maxth) {
+    FsTree tr;
+    flashsearch_tree_init(&tr);
+    
+    Context ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    if (flashsearch_tree(NULL, root, "\0", 1, &tr, maxth, NULL, NULL, &ctx) < 0) {
+        printf("Can't walk %s\n", root);
+        return;
+    }
+    
+    printf("=== TREE ===\n");
+    printf("Root: %s, %ld files, %ld dirs, %ld skipped, %.1f MB\n\n",
+           root, tr.files, tr.dirs, tr.skipped, tr.bytes / 1e6);
+    
+    const char *p = "\"nonexistent\":\"xyz123\"";
+    char name[48], label[64];
+    BenchCase c = {"tree", name, BENCH_TREE, root, tr.bytes, p, strlen(p), &tr, 0, maxth, -1, 0};
+    
+    printf("Threads (no match)\n");
+    for (int th = 1;; th *= 2) {
+        if (th > maxth) th = maxth;
+        c.t = th;
+        snprintf(name, sizeof(name), "tree_th%d", th);
+        snprintf(label, sizeof(label), "  %2d th: ", th);
+        measure(&c, label);
+        if (th == maxth) break;
+    }
+    
+    printf("\nFiles with matches (\"the\", %d th)\n", maxth);
+    c.t = maxth;
+    c.p = "the";
+    c.pl = 3;
+    tr.flags = FS_TREE_FIRST;
+    snprintf(name, sizeof(name), "tree_first");
+    measure(&c, "  first: ");
+    
+    tr.flags = 0;
+    snprintf(name, sizeof(name), "tree_all");
+    measure(&c, "  all:   ");
+    
+    printf("\n");
 }
 
 void run_tests(const char *fname, int maxth) {
@@ -67,13 +595,25 @@ void run_tests(const char *fname, int maxth) {
     
     size_t fsize = st.st_size;
     printf("File: %s (%.2f GB)\n", fname, fsize / 1e9);
+    printf("Timing: %d warmup, %d reps, median [95%% CI] and p99 per row\n", bo.warmup, bo.reps);
     
-    void *addr = load_file(fname, &fsize);
-    if (!addr) {
+    FsFile *ff = flashsearch_open_file(fname, 0, maxth);
+    const void *addr = flashsearch_file_data(ff, &fsize);
+    if (!ff) {
         printf("Can't load\n");
         return;
     }
     
+    flashsearch_numa_place(addr, fsize);
+    
+    FsFileStats fst;
+    flashsearch_file_stats(ff, &fst);
+    if (fst.strategy == FS_FILE_MMAP) {
+        cold_map = addr;
+        cold_len = fsize;
+        cold_fd = open(fname, O_RDONLY);
+    }
+    
     printf("\n=== TESTS ===\n\n");
     
     struct {
@@ -89,92 +629,190 @@ void run_tests(const char *fname, int maxth) {
     };
     
     int ntests = sizeof(tests) / sizeof(tests[0]);
+    char label[32];
+    
+    BenchCase c = {"file", NULL, BENCH_FIRST, addr, fsize, NULL, 0, NULL, 0, 1, -1, 0};
     
     for (int t = 0; t < ntests; t++) {
         printf("Test %d: %s\n", t + 1, tests[t].desc);
         printf("Pattern: %s\n\n", tests[t].patt);
         
-        size_t plen = strlen(tests[t].patt);
+        c.name = tests[t].desc;
+        c.p = tests[t].patt;
+        c.pl = strlen(tests[t].patt);
+        c.pos = tests[t].where < 0 ? -1 : tests[t].where / 2.0;
+        
         double best = 0;
         int bestt = 0;
         
         for (int th = 1; th <= maxth; th = th <= 8 ? th * 2 : th + 8) {
             if (th > maxth) th = maxth;
             
-            printf("  %2d th: ", th);
-            fflush(stdout);
-            
-            Context ctx;
-            struct timespec s, e;
-            
-            volatile char *c = malloc(10000000);
-            if (c) {
-                for (int i = 0; i < 10000000; i += 64) c[i] = i;
-                free((void*)c);
-            }
-            
-            clock_gettime(CLOCK_MONOTONIC, &s);
-            
-            const char *res = flashsearch_hyper((const char*)addr, fsize,
-                                                  tests[t].patt, plen,
-                                                  th, &ctx);
-            
-            clock_gettime(CLOCK_MONOTONIC, &e);
-            
-            double ms = (e.tv_sec - s.tv_sec) * 1000.0 +
-                       (e.tv_nsec - s.tv_nsec) / 1e6;
-            
-            double gbps = flashsearch_gbps(&ctx, ms);
-            uint64_t scanned = atomic_load(&ctx.bytes_scanned);
-            
-            printf("%6.1f ms, %5.1f GB/s", ms, gbps);
+            c.t = th;
+            snprintf(label, sizeof(label), "  %2d th: ", th);
+            const BenchRow *r = measure(&c, label);
             
-            if (res) {
-                printf(" ✓ Found\n");
-            } else {
-                printf(" ✗ Not found (%.1fMB)\n", scanned / 1e6);
-            }
-            
-            if (gbps > best) {
-                best = gbps;
+            if (r && r->gbps > best) {
+                best = r->gbps;
                 bestt = th;
             }
-            
-            usleep(30000);
+            if (r && !r->hits) printf("         ✗ Not found\n");
         }
         
         printf("  Best: %.1f GB/s with %d th\n\n", best, bestt);
     }
     
-    printf("=== FULL SCAN ===\n");
+    flashsearch_file_stats(ff, &fst);
+    printf("Pages: %ld minor / %ld major faults, %.0f MB readahead, %.0f%% resident%s\n\n",
+           fst.minor_faults, fst.major_faults, fst.readahead / 1e6,
+           fsize ? 100.0 * fst.resident / fsize : 100.0,
+           fst.huge == FS_HUGE_TLB ? ", hugetlb" : fst.huge == FS_HUGE_THP ? ", THP" : "");
     
-    const char *fullpatt = "\"impossible\":\"pattern\"";
-    size_t fullplen = strlen(fullpatt);
+    printf("=== FIND ALL ===\n");
     
-    int optth = maxth / 2;
-    if (optth < 4) optth = 4;
+    c.name = "find all";
+    c.op = BENCH_ALL;
+    c.p = "\"tag\":\"tag1234\"";
+    c.pl = strlen(c.p);
+    c.t = maxth;
+    c.pos = -1;
     
-    printf("Scan all with %d th...\n", optth);
+    printf("Pattern: %s\n", c.p);
+    const BenchRow *ar = measure(&c, "  ");
+    if (ar) printf("Hits: %ld\n\n", ar->hits);
     
-    Context ctx;
-    struct timespec s, e;
-    clock_gettime(CLOCK_MONOTONIC, &s);
+    printf("=== MULTI ===\n");
     
-    flashsearch_hyper((const char*)addr, fsize, fullpatt, 
-                     fullplen, optth, &ctx);
+    const char *mpats[5];
+    size_t mlens[5];
+    for (int t = 0; t < ntests; t++) {
+        mpats[t] = tests[t].patt;
+        mlens[t] = strlen(tests[t].patt);
+    }
     
-    clock_gettime(CLOCK_MONOTONIC, &e);
+    FsMulti *mp = flashsearch_multi_compile(mpats, mlens, ntests);
+    if (mp) {
+        c.name = "multi";
+        c.op = BENCH_MULTI;
+        c.obj = mp;
+        c.pl = 0;
+        
+        printf("Patterns: %d in one pass\n", ntests);
+        const BenchRow *mr = measure(&c, "  ");
+        if (mr) printf("Hits: %ld\n\n", mr->hits);
+        
+        flashsearch_multi_free(mp);
+    }
+    
+    printf("=== BATCH ===\n");
+    
+    FsJob jobs[5];
+    for (int t = 0; t < ntests; t++) {
+        jobs[t].pattern = mpats[t];
+        jobs[t].pattern_len = mlens[t];
+        jobs[t].flags = 0;
+    }
+    
+    c.name = "batch";
+    c.op = BENCH_BATCH;
+    c.obj = jobs;
+    c.nobj = ntests;
+    
+    printf("Queries: %d in one blocked pass\n", ntests);
+    const BenchRow *br = measure(&c, "  ");
+    if (br) printf("Found: %ld\n\n", br->hits);
+    
+    printf("=== REGEX ===\n");
+    
+    FsRegex *rx = flashsearch_regex_compile("\"id\":5[0-9]{6}", 0);
+    if (rx) {
+        c.name = "regex";
+        c.op = BENCH_REGEX;
+        c.obj = rx;
+        c.nobj = 0;
+        
+        printf("Expr: \"id\":5[0-9]{6}\n");
+        const BenchRow *rr = measure(&c, "  ");
+        if (rr) printf("%s\n\n", rr->hits ? "Found" : "Not found");
+        
+        flashsearch_regex_free(rx);
+    }
     
-    double ms = (e.tv_sec - s.tv_sec) * 1000.0 +
-               (e.tv_nsec - s.tv_nsec) / 1e6;
+    printf("=== JSON ===\n");
     
-    double gbps = flashsearch_gbps(&ctx, ms);
-    uint64_t scanned = atomic_load(&ctx.bytes_scanned);
+    Context jctx;
+    struct timespec js, je;
+    clock_gettime(CLOCK_MONOTONIC, &js);
     
-    printf("Full: %.1f ms\n", ms);
-    printf("Speed: %.1f GB/s\n", gbps);
-    printf("Bytes: %.1f MB (%.1f%%)\n", 
-           scanned / 1e6, (scanned > fsize ? 100.0 : (scanned * 100.0) / fsize));
+    const char *jr = flashsearch_json((const char*)addr, fsize,
+                                      "id", "500", maxth, &jctx);
+    
+    clock_gettime(CLOCK_MONOTONIC, &je);
+    
+    double jms = (je.tv_sec - js.tv_sec) * 1000.0 +
+                (je.tv_nsec - js.tv_nsec) / 1e6;
+    
+    printf("Field: id = 500\n");
+    printf("%s in %.1f ms\n\n", jr ? "Found" : "Not found", jms);
+    
+    printf("=== INDEX ===\n");
+    
+    char ipath[4096];
+    snprintf(ipath, sizeof(ipath), "%s.fsidx", fname);
+    
+    struct timespec is, ie;
+    clock_gettime(CLOCK_MONOTONIC, &is);
+    
+    int irc = flashsearch_index_build(NULL, (const char*)addr, fsize, ipath, maxth);
+    
+    clock_gettime(CLOCK_MONOTONIC, &ie);
+    
+    double ims = (ie.tv_sec - is.tv_sec) * 1000.0 +
+                (ie.tv_nsec - is.tv_nsec) / 1e6;
+    
+    FsIndex *ix = irc == 0 ? flashsearch_index_open(ipath) : NULL;
+    if (ix) {
+        const char *ipatt = "\"key\":\"key09999999\"";
+        
+        Context ictx;
+        clock_gettime(CLOCK_MONOTONIC, &is);
+        
+        const char *ir = flashsearch_index_find(ix, (const char*)addr, fsize,
+                                                ipatt, strlen(ipatt), &ictx);
+        
+        clock_gettime(CLOCK_MONOTONIC, &ie);
+        
+        double qms = (ie.tv_sec - is.tv_sec) * 1000.0 +
+                    (ie.tv_nsec - is.tv_nsec) / 1e6;
+        
+        printf("Build/refresh: %.1f ms (%s)\n", ims, ipath);
+        printf("Query: %s\n", ipatt);
+        printf("%s in %.3f ms, verified %.1f MB\n\n", ir ? "Found" : "Not found",
+               qms, atomic_load(&ictx.bytes_scanned) / 1e6);
+        
+        flashsearch_index_close(ix);
+    } else {
+        printf("No index\n\n");
+    }
+    
+    printf("=== FULL SCAN ===\n");
+    
+    int optth = maxth / 2;
+    if (optth < 4) optth = 4;
+    
+    c.name = "full scan";
+    c.op = BENCH_FIRST;
+    c.p = "\"impossible\":\"pattern\"";
+    c.pl = strlen(c.p);
+    c.obj = NULL;
+    c.t = optth;
+    
+    printf("Scan all with %d th...\n", optth);
+    const BenchRow *fr = measure(&c, "  ");
+    double gbps = fr ? fr->gbps : 0;
+    
+    printf("Bytes: %.1f MB\n", fr ? fr->need / 1e6 : 0);
+    if (fr) printf("Candidates: %llu\n", fr->cand);
     
     printf("\n=== RATING ===\n");
     
@@ -192,37 +830,121 @@ void run_tests(const char *fname, int maxth) {
         printf("📊 MEH\n");
     }
     
-    unload_file(addr, fsize);
+    if (cold_fd >= 0) close(cold_fd);
+    cold_fd = -1;
+    cold_map = NULL;
+    flashsearch_close_file(ff);
+}
+
+void usage(const char *prog) {
+    printf("Usage: %s [options]\n", prog);
+    printf("  --reps N       timed repetitions per case (default %d)\n", bo.reps);
+    printf("  --warmup N     untimed runs before each case (default %d)\n", bo.warmup);
+    printf("  --mode M       warm, cold or both (default warm)\n");
+    printf("  --threads N    max threads (default %d)\n", bo.maxth);
+    printf("  --file PATH    data file (default %s)\n", bo.fname);
+    printf("  --sweep        add the synthetic length/position/density/thread sweep\n");
+    printf("  --size MB      sweep buffer size (default %zu)\n", bo.size);
+    printf("  --gen          regenerate the data file even if it exists\n");
+    printf("  --records N    records to generate (default %ld)\n", bo.records);
+    printf("  --zipf S       Zipf exponent for tag values, 0 = uniform\n");
+    printf("  --tree DIR     add a recursive directory search over DIR\n");
+    printf("  --csv PATH     write all rows as CSV\n");
+    printf("  --json PATH    write all rows as JSON\n");
+    printf("  --seams        only run the chunk-boundary check; exit 1 on any miss\n");
 }
 
-int main() {
+int main(int argc, char **argv) {
+    static struct option lo[] = {
+        {"reps", required_argument, 0, 'r'},
+        {"warmup", required_argument, 0, 'w'},
+        {"mode", required_argument, 0, 'm'},
+        {"threads", required_argument, 0, 't'},
+        {"file", required_argument, 0, 'f'},
+        {"sweep", no_argument, 0, 's'},
+        {"size", required_argument, 0, 'z'},
+        {"gen", no_argument, 0, 'g'},
+        {"records", required_argument, 0, 'n'},
+        {"zipf", required_argument, 0, 'Z'},
+        {"tree", required_argument, 0, 'T'},
+        {"csv", required_argument, 0, 'c'},
+        {"json", required_argument, 0, 'j'},
+        {"seams", no_argument, 0, 'S'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0},
+    };
+    
+    int o;
+    while ((o = getopt_long(argc, argv, "r:w:m:t:f:sz:gn:Z:T:c:j:Sh", lo, NULL)) != -1) {
+        switch (o) {
+        case 'r': bo.reps = atoi(optarg); break;
+        case 'w': bo.warmup = atoi(optarg); break;
+        case 'm':
+            bo.modes = !strcmp(optarg, "cold") ? BENCH_COLD :
+                       !strcmp(optarg, "both") ? BENCH_WARM | BENCH_COLD : BENCH_WARM;
+            break;
+        case 't': bo.maxth = atoi(optarg); break;
+        case 'f': bo.fname = optarg; break;
+        case 's': bo.sweep = 1; break;
+        case 'z': bo.size = strtoull(optarg, NULL, 10); break;
+        case 'g': bo.gen = 1; break;
+        case 'n': bo.records = atol(optarg); break;
+        case 'Z': bo.zipf = atof(optarg); break;
+        case 'T': bo.tree = optarg; break;
+        case 'c': bo.csv = optarg; break;
+        case 'j': bo.json = optarg; break;
+        case 'S': bo.seams = 1; break;
+        default:
+            usage(argv[0]);
+            return o == 'h' ? 0 : 1;
+        }
+    }
+    
+    if (bo.seams) return check_seams(MAX_THREADS) != 0;
+    
+    if (bo.reps < 1) bo.reps = 1;
+    if (bo.warmup < 0) bo.warmup = 0;
+    if (bo.maxth < 1) bo.maxth = 1;
+    if (bo.maxth > MAX_THREADS) bo.maxth = MAX_THREADS;
+    if (bo.size < 1) bo.size = 1;
+    
     printf("\n");
     printf("╔══════════════════════════════════╗\n");
     printf("║       FLASHSEARCH TEST           ║\n");
     printf("╚══════════════════════════════════╝\n");
     printf("\n");
     
-    const char *fname = "data.json";
-    long num = 10000000;
-    int maxth = 16;
+    const char *fname = bo.fname;
+    long num = bo.records;
+    int maxth = bo.maxth;
     
     printf("Config:\n");
     printf("  File: %s\n", fname);
     printf("  Records: %ld mil\n", num / 1000000);
     printf("  Size: ~1GB\n");
     printf("  Max th: %d\n", maxth);
+    printf("  NUMA nodes: %d\n", flashsearch_numa_nodes());
+    printf("  Reps: %d (+%d warmup), %s\n", bo.reps, bo.warmup,
+           bo.modes == BENCH_COLD ? "cold" : bo.modes == BENCH_WARM ? "warm" : "warm+cold");
     printf("\n");
     
     struct stat st;
-    if (stat(fname, &st) != 0) {
+    if (bo.gen || stat(fname, &st) != 0) {
         printf("Making data...\n");
-        make_data(fname, num);
+        make_data(fname, num, bo.zipf, MAX_THREADS);
     } else {
         printf("Using old data...\n");
     }
     
+    int missed = check_seams(MAX_THREADS);
+    if (bo.sweep) run_sweep(maxth);
+    if (bo.tree) run_tree(bo.tree, maxth);
     run_tests(fname, maxth);
     
+    if (bo.csv || bo.json) printf("\n");
+    if (bo.csv) write_csv(bo.csv);
+    if (bo.json) write_json(bo.json);
+    
     printf("\n");
     printf("══════════════════════════════════\n");
     printf("            DONE                  \n");
@@ -235,5 +957,7 @@ int main() {
     printf("  4. Fit in RAM\n");
     printf("\n");
     
-    return 0;
+    free(rows);
+    free(evict_buf);
+    return missed != 0;
 }
@@ -6,56 +6,15 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
-#include <sys/mman.h>
-
-void *load_file(const char *fn, size_t *sz) {
-    int fd = open(fn, O_RDONLY);
-    if (fd < 0) return NULL;
-    
-    struct stat st;
-    if (fstat(fd, &st) < 0) {
-        close(fd);
-        return NULL;
-    }
-    
-    *sz = st.st_size;
-    void *a = mmap(NULL, *sz, PROT_READ, MAP_PRIVATE, fd, 0);
-    close(fd);
-    
-    return a != MAP_FAILED ? a : NULL;
-}
-
-void unload_file(void *x, size_t s) {
-    if (x) munmap(x, s);
-}
 
 void make_data(const char *fn, long n) {
     printf("Making %ldM...\n", n / 1000000);
     
-    FILE *f = fopen(fn, "w");
-    if (!f) return;
+    FsGen g;
+    flashsearch_gen_init(&g, n);
+    if (flashsearch_generate(&g, fn, MAX_THREADS) != 0) return;
     
-    setvbuf(f, NULL, _IOFBF, 65536);
-    
-    fprintf(f, "[\n");
-    
-    for (long i = 0; i < n; i++) {
-        fprintf(f, "{\"id\":%ld,\"key\":\"key%08ld\",\"value\":%ld,\"tag\":\"tag%04ld\"}",
-                i, i, i * 3, i % 10000);
-        
-        if (i < n - 1) fprintf(f, ",\n");
-        
-        if (i % (n / 10) == 0 && i > 0) {
-            printf("  Made %ldM\n", i / 1000000);
-        }
-    }
-    
-    fprintf(f, "\n]\n");
-    fclose(f);
-    
-    struct stat st;
-    stat(fn, &st);
-    printf("Made: %s (%.2f GB)\n\n", fn, st.st_size / 1e9);
+    printf("Made: %s (%.2f GB)\n\n", fn, g.bytes / 1e9);
 }
 
 void run_tests(const char *fn, int maxt) {
@@ -68,8 +27,9 @@ void run_tests(const char *fn, int maxt) {
     size_t fs = st.st_size;
     printf("File: %s (%.2f GB)\n", fn, fs / 1e9);
     
-    void *a = load_file(fn, &fs);
-    if (!a) {
+    FsFile *ff = flashsearch_open_file(fn, 0, maxt);
+    const void *a = flashsearch_file_data(ff, &fs);
+    if (!ff) {
         printf("Can't load\n");
         return;
     }
@@ -192,7 +152,7 @@ void run_tests(const char *fn, int maxt) {
         printf("📊 MEH\n");
     }
     
-    unload_file(a, fs);
+    flashsearch_close_file(ff);
 }
 
 int main() {
@@ -0,0 +1,199 @@
+#include "flashsearch.h"
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FS_SOCKET "/tmp/flashsearch.sock"
+
+FsDaemon *the_daemon;
+
+void on_signal(int sig) {
+    (void)sig;
+    flashsearch_daemon_stop(the_daemon);
+}
+
+double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+void usage(const char *prog) {
+    printf("Usage:\n");
+    printf("  %s serve [-t threads] [-s socket] name=path ...\n", prog);
+    printf("  %s query [-s socket] [-a | -l] [-i] [-n max] [-r reps] name pattern\n", prog);
+    printf("\n");
+    printf("  -a  all offsets    -l  count matching lines\n");
+    printf("  -i  ignore case    -n  cap on returned offsets (default 10)\n");
+    printf("  -r  repeat the query and report round-trip latency\n");
+}
+
+int serve(int argc, char **argv) {
+    const char *sock = FS_SOCKET;
+    int t = 0;
+    int o;
+    
+    while ((o = getopt(argc, argv, "t:s:")) != -1) {
+        switch (o) {
+        case 't': t = atoi(optarg); break;
+        case 's': sock = optarg; break;
+        default: return 1;
+        }
+    }
+    
+    if (optind >= argc) {
+        printf("No corpora\n");
+        return 1;
+    }
+    
+    the_daemon = flashsearch_daemon_create(t);
+    if (!the_daemon) {
+        printf("Can't start\n");
+        return 1;
+    }
+    
+    for (int i = optind; i < argc; i++) {
+        char name[64];
+        const char *eq = strchr(argv[i], '=');
+        const char *path = eq ? eq + 1 : argv[i];
+        size_t nl = eq ? (size_t)(eq - argv[i]) : strlen(argv[i]);
+        if (nl >= sizeof(name)) nl = sizeof(name) - 1;
+        memcpy(name, argv[i], nl);
+        name[nl] = 0;
+        
+        double t0 = now_us();
+        int id = flashsearch_daemon_load(the_daemon, name, path, 0);
+        if (id < 0) {
+            printf("Can't load %s\n", path);
+            flashsearch_daemon_destroy(the_daemon);
+            return 1;
+        }
+        printf("Loaded %s (%s) as #%d in %.1f ms\n", name, path, id, (now_us() - t0) / 1e3);
+    }
+    
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+    
+    printf("Serving on %s\n", sock);
+    fflush(stdout);
+    
+    int rc = flashsearch_daemon_serve(the_daemon, sock);
+    flashsearch_daemon_destroy(the_daemon);
+    
+    if (rc != 0) printf("Can't serve on %s\n", sock);
+    return rc != 0;
+}
+
+int cmp_double(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+int query(int argc, char **argv) {
+    const char *sock = FS_SOCKET;
+    FsQuery q;
+    memset(&q, 0, sizeof(q));
+    q.op = FS_Q_FIRST;
+    q.max = 10;
+    int reps = 1;
+    int o;
+    
+    while ((o = getopt(argc, argv, "s:alin:r:")) != -1) {
+        switch (o) {
+        case 's': sock = optarg; break;
+        case 'a': q.op = FS_Q_ALL; break;
+        case 'l': q.op = FS_Q_LINES; break;
+        case 'i': q.flags |= FS_ICASE; break;
+        case 'n': q.max = strtoull(optarg, NULL, 10); break;
+        case 'r': reps = atoi(optarg); break;
+        default: return 1;
+        }
+    }
+    
+    if (argc - optind != 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (reps < 1) reps = 1;
+    
+    int fd = flashsearch_client_open(sock);
+    if (fd < 0) {
+        printf("Can't connect to %s\n", sock);
+        return 1;
+    }
+    
+    const char *name = argv[optind];
+    const char *pat = argv[optind + 1];
+    
+    FsQuery lq;
+    memset(&lq, 0, sizeof(lq));
+    lq.op = FS_Q_LOOKUP;
+    lq.pattern_len = strlen(name);
+    
+    FsReply r;
+    long id = flashsearch_client_query(fd, &lq, name, &r, NULL);
+    if (id < 0) {
+        printf("No corpus: %s\n", name);
+        close(fd);
+        return 1;
+    }
+    
+    q.corpus = id;
+    q.pattern_len = strlen(pat);
+    
+    double *lat = malloc(reps * sizeof(double));
+    uint64_t *offs = NULL;
+    long n = -1;
+    
+    for (int i = 0; i < reps && lat; i++) {
+        free(offs);
+        double t0 = now_us();
+        n = flashsearch_client_query(fd, &q, pat, &r, &offs);
+        lat[i] = now_us() - t0;
+        if (n < 0) break;
+    }
+    close(fd);
+    
+    if (n < 0 || !lat) {
+        printf("Query failed\n");
+        free(lat);
+        free(offs);
+        return 1;
+    }
+    
+    printf("Count: %ld\n", n);
+    for (uint64_t i = 0; i < r.nout; i++) printf("  @%llu\n", (unsigned long long)offs[i]);
+    if (r.nout < (uint64_t)n && q.op == FS_Q_ALL) printf("  ... %llu more\n", (unsigned long long)(n - r.nout));
+    
+    printf("Scanned: %.1f MB, %u th, %llu cycles\n", r.bytes / 1e6, r.threads,
+           (unsigned long long)r.cycles);
+    printf("Candidates: %llu (%llu false), chunks %llu, steals %llu\n",
+           (unsigned long long)r.stats.candidates, (unsigned long long)r.stats.false_positives,
+           (unsigned long long)r.stats.chunks, (unsigned long long)r.stats.steals);
+    
+    qsort(lat, reps, sizeof(double), cmp_double);
+    printf("Round trip: %.1f us median, %.1f us min, %.1f us max (%d runs)\n",
+           lat[reps / 2], lat[0], lat[reps - 1], reps);
+    
+    free(lat);
+    free(offs);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    
+    if (!strcmp(argv[1], "serve")) return serve(argc - 1, argv + 1);
+    if (!strcmp(argv[1], "query")) return query(argc - 1, argv + 1);
+    
+    usage(argv[0]);
+    return 1;
+}
@@ -1,4 +1,4 @@
-#include "flashsearch.h"
+#include "flashsearch_internal.h"
 #include <string.h>
 #include <x86intrin.h>
 #include <stdlib.h>
@@ -15,275 +15,1294 @@ unsigned long long rdtsc() {
     return __rdtscp(&dummy);
 }
 
+const uint8_t fs_default_rank[256] = {
+    164,   0,   1,   2,   3,   4,   5,   6,   7, 204, 234,   8,   9, 192,  10,  11,
+     12,  13,  14,  15,  16,  17,  18,  19,  20,  21,  22,  23,  24,  25,  26,  27,
+    255, 169, 245, 170, 165, 171, 172, 197, 201, 202, 183, 173, 239, 218, 232, 212,
+    242, 241, 235, 229, 227, 228, 224, 220, 221, 222, 236, 198, 184, 203, 185, 174,
+    166, 211, 179, 195, 196, 219, 189, 186, 200, 208, 161, 168, 199, 190, 209, 210,
+    188, 159, 205, 207, 217, 191, 175, 181, 162, 182, 160, 193, 176, 194, 157, 213,
+    163, 252, 223, 240, 243, 254, 233, 230, 246, 249, 180, 206, 244, 237, 250, 251,
+    231, 177, 247, 248, 253, 238, 214, 225, 187, 226, 178, 215, 167, 216, 158,  28,
+     29,  30,  31,  32,  33,  34,  35,  36,  37,  38,  39,  40,  41,  42,  43,  44,
+     45,  46,  47,  48,  49,  50,  51,  52,  53,  54,  55,  56,  57,  58,  59,  60,
+     61,  62,  63,  64,  65,  66,  67,  68,  69,  70,  71,  72,  73,  74,  75,  76,
+     77,  78,  79,  80,  81,  82,  83,  84,  85,  86,  87,  88,  89,  90,  91,  92,
+     93,  94,  95,  96,  97,  98,  99, 100, 101, 102, 103, 104, 105, 106, 107, 108,
+    109, 110, 111, 112, 113, 114, 115, 116, 117, 118, 119, 120, 121, 122, 123, 124,
+    125, 126, 127, 128, 129, 130, 131, 132, 133, 134, 135, 136, 137, 138, 139, 140,
+    141, 142, 143, 144, 145, 146, 147, 148, 149, 150, 151, 152, 153, 154, 155, 156,
+};
+
+uint8_t fs_rank[256];
+int fs_kernel_id = FS_KERNEL_SCALAR;
+FsFindFn fs_find_fn = NULL;
+__thread unsigned long long fs_tl_cand;
+__thread unsigned long long fs_tl_miss;
+
+void needle_anchor(FsNeedle *nd);
+
+static inline int is_alpha(uint8_t c) {
+    return (uint8_t)((c | 0x20) - 'a') < 26;
+}
+
+static inline uint8_t fold_key(const FsNeedle *nd, uint8_t c) {
+    return (nd->icase && is_alpha(c)) ? (c | 0x20) : c;
+}
+
+static inline int fold_rank(const FsNeedle *nd, uint8_t c) {
+    if (!nd->icase || !is_alpha(c)) return fs_rank[c];
+    int lo = fs_rank[c | 0x20], up = fs_rank[c & ~0x20];
+    return lo > up ? lo : up;
+}
+
+void needle_init(FsNeedle *nd, const char *n, size_t nl, int flags) {
+    nd->n = n;
+    nd->nl = nl;
+    nd->icase = (flags & FS_ICASE) != 0;
+    nd->i1 = 0;
+    nd->i2 = nl > 1 ? 1 : 0;
+    
+    nd->ci = 0;
+    nd->kernel = fs_kernel_id;
+    nd->find = fs_find_fn;
+    
+    if (nl >= 2) needle_anchor(nd);
+    
+    nd->nf = 0;
+    nd->nfold = 0;
+    nd->cl = nl < 4 ? nl : 4;
+    for (size_t i = 0; i < nd->cl; i++) {
+        uint8_t c = fold_key(nd, (uint8_t)n[nd->ci + i]);
+        nd->nf |= (unsigned int)c << (8 * i);
+        if (nd->icase && is_alpha(c)) nd->nfold |= 0x20u << (8 * i);
+    }
+    
+    uint8_t a1 = (uint8_t)n[nd->i1], a2 = (uint8_t)n[nd->i2];
+    memset(nd->v1, fold_key(nd, a1), sizeof(nd->v1));
+    memset(nd->v2, fold_key(nd, a2), sizeof(nd->v2));
+    memset(nd->f1, (nd->icase && is_alpha(a1)) ? 0x20 : 0, sizeof(nd->f1));
+    memset(nd->f2, (nd->icase && is_alpha(a2)) ? 0x20 : 0, sizeof(nd->f2));
+}
+
+uint8_t *needle_unique(const FsNeedle *nd) {
+    const uint8_t *n = (const uint8_t*)nd->n;
+    size_t nl = nd->nl;
+    
+    uint8_t *use = malloc(nl);
+    uint8_t *cnt = calloc(1 << FS_LONG_BITS, 1);
+    if (!use || !cnt) {
+        free(use);
+        free(cnt);
+        return NULL;
+    }
+    
+    for (size_t i = 0; i + 3 <= nl; i++) {
+        uint32_t x = fold_key(nd, n[i]) | fold_key(nd, n[i + 1]) << 8 |
+                     (uint32_t)fold_key(nd, n[i + 2]) << 16;
+        uint32_t k = (x * 0x9E3779B1u) >> (32 - FS_LONG_BITS);
+        if (cnt[k] < 2) cnt[k]++;
+    }
+    
+    size_t nu = 0;
+    memset(use, 0, nl);
+    for (size_t i = 0; i + 3 <= nl; i++) {
+        uint32_t x = fold_key(nd, n[i]) | fold_key(nd, n[i + 1]) << 8 |
+                     (uint32_t)fold_key(nd, n[i + 2]) << 16;
+        uint32_t k = (x * 0x9E3779B1u) >> (32 - FS_LONG_BITS);
+        if (cnt[k] != 1) continue;
+        
+        use[i + 1] = 1;
+        if (i == 0) use[0] = 1;
+        if (i + 3 == nl) use[nl - 1] = 1;
+        nu++;
+    }
+    
+    free(cnt);
+    if (nu < 2) {
+        free(use);
+        return NULL;
+    }
+    return use;
+}
+
+void needle_anchor(FsNeedle *nd) {
+    const uint8_t *n = (const uint8_t*)nd->n;
+    size_t nl = nd->nl;
+    uint8_t *use = nl > FS_LONG_NEEDLE ? needle_unique(nd) : NULL;
+    
+    size_t r1 = SIZE_MAX;
+    for (size_t i = 0; i < nl; i++) {
+        if (use && !use[i]) continue;
+        if (r1 == SIZE_MAX || fold_rank(nd, n[i]) < fold_rank(nd, n[r1])) r1 = i;
+    }
+    
+    uint8_t k1 = fold_key(nd, n[r1]);
+    size_t r2 = SIZE_MAX;
+    for (size_t i = 0; i < nl; i++) {
+        if (i == r1 || (use && !use[i])) continue;
+        if (r2 == SIZE_MAX) {
+            r2 = i;
+            continue;
+        }
+        int same = fold_key(nd, n[i]) == k1;
+        int best_same = fold_key(nd, n[r2]) == k1;
+        if (best_same && !same) {
+            r2 = i;
+        } else if (same == best_same &&
+                   fold_rank(nd, n[i]) < fold_rank(nd, n[r2])) {
+            r2 = i;
+        }
+    }
+    
+    int best = -1;
+    for (size_t i = 0; use && i + 4 <= nl; i++) {
+        int u = use[i] + use[i + 1] + use[i + 2] + use[i + 3];
+        if (u > best) {
+            best = u;
+            nd->ci = i;
+        }
+    }
+    free(use);
+    
+    nd->i1 = r1 < r2 ? r1 : r2;
+    nd->i2 = r1 < r2 ? r2 : r1;
+}
+
+int needle_eq(const char *h, const FsNeedle *nd) {
+    if (!nd->icase) return memcmp(h, nd->n, nd->nl) == 0;
+    
+    const uint8_t *a = (const uint8_t*)h;
+    const uint8_t *b = (const uint8_t*)nd->n;
+    for (size_t i = 0; i < nd->nl; i++) {
+        if (a[i] == b[i]) continue;
+        if (!is_alpha(b[i]) || (a[i] | 0x20) != (b[i] | 0x20)) return 0;
+    }
+    return 1;
+}
+
+void flashsearch_learn_freq(const char *data, size_t len) {
+    if (!data || len == 0) return;
+    
+    size_t cnt[256];
+    memset(cnt, 0, sizeof(cnt));
+    
+    size_t step = len / FS_FREQ_SAMPLES;
+    size_t sl = FS_FREQ_SAMPLE_BYTES;
+    if (step < sl) step = sl;
+    
+    for (size_t off = 0; off < len; off += step) {
+        size_t e = off + sl < len ? off + sl : len;
+        for (size_t i = off; i < e; i++) cnt[(uint8_t)data[i]]++;
+    }
+    
+    uint8_t order[256];
+    for (int i = 0; i < 256; i++) order[i] = (uint8_t)i;
+    
+    for (int i = 1; i < 256; i++) {
+        uint8_t b = order[i];
+        int j = i - 1;
+        while (j >= 0 && (cnt[order[j]] > cnt[b] ||
+                          (cnt[order[j]] == cnt[b] && fs_rank[order[j]] > fs_rank[b]))) {
+            order[j + 1] = order[j];
+            j--;
+        }
+        order[j + 1] = b;
+    }
+    
+    uint8_t nr[256];
+    for (int i = 0; i < 256; i++) nr[order[i]] = (uint8_t)i;
+    memcpy(fs_rank, nr, sizeof(nr));
+}
+
+void flashsearch_reset_freq(void) {
+    memcpy(fs_rank, fs_default_rank, sizeof(fs_rank));
+}
+
+static inline const char *check_mask(const char *h, size_t base, uint64_t m,
+                                     const FsNeedle *nd, size_t *bs) {
+    while (m) {
+        size_t idx = base + __builtin_ctzll(m);
+        
+        unsigned int hf = 0;
+        memcpy(&hf, h + idx + nd->ci, nd->cl);
+        fs_tl_cand++;
+        
+        if ((hf | nd->nfold) == nd->nf) {
+            if (needle_eq(h + idx, nd)) {
+                *bs = idx + nd->nl;
+                return h + idx;
+            }
+            fs_tl_miss++;
+        }
+        
+        m &= m - 1;
+    }
+    
+    return NULL;
+}
+
+const char *tail_find(const char *h, size_t hl, size_t ii,
+                      const FsNeedle *nd, size_t *bs) {
+    size_t nl = nd->nl, i1 = nd->i1;
+    uint8_t a = nd->v1[0], f = nd->f1[0];
+    
+    for (; ii + nl <= hl; ii++) {
+        if (((uint8_t)h[ii + i1] | f) == a) {
+            fs_tl_cand++;
+            if (needle_eq(h + ii, nd)) {
+                *bs = ii + nl;
+                return h + ii;
+            }
+            fs_tl_miss++;
+        }
+    }
+    
+    *bs = hl;
+    return NULL;
+}
+
+const char *scalar_find(const char *h, size_t hl,
+                        const FsNeedle *nd,
+                        atomic_bool *stop,
+                        size_t *bs) {
+    const char *n = nd->n;
+    size_t nl = nd->nl, i1 = nd->i1;
+    
+    *bs = 0;
+    if (nl == 0 || nl > hl) return NULL;
+    if (nd->f1[0]) {
+        size_t ii = 0;
+        const char *f = NULL;
+        while (ii < hl && !f) {
+            if (stop && atomic_load_explicit(stop, memory_order_relaxed)) {
+                *bs = ii;
+                return NULL;
+            }
+            size_t e = ii + FS_STOP_SLICE < hl ? ii + FS_STOP_SLICE : hl;
+            f = tail_find(h, e + nl - 1 < hl ? e + nl - 1 : hl, ii, nd, bs);
+            ii = e;
+        }
+        if (!f) *bs = hl;
+        return f;
+    }
+    
+    size_t last = hl - nl;
+    size_t ii = 0;
+    
+    while (ii <= last) {
+        if (stop && atomic_load_explicit(stop, memory_order_relaxed)) {
+            *bs = ii;
+            return NULL;
+        }
+        
+        size_t sl = last + 1 - ii;
+        if (sl > FS_STOP_SLICE) sl = FS_STOP_SLICE;
+        
+        const char *f = memchr(h + ii + i1, n[i1], sl);
+        if (!f) {
+            ii += sl;
+            continue;
+        }
+        
+        size_t idx = f - h - i1;
+        fs_tl_cand++;
+        if (needle_eq(h + idx, nd)) {
+            *bs = idx + nl;
+            return h + idx;
+        }
+        fs_tl_miss++;
+        ii = idx + 1;
+    }
+    
+    *bs = hl;
+    return NULL;
+}
+
+__attribute__((target("sse4.2")))
+const char *sse42_find(const char *h, size_t hl,
+                       const FsNeedle *nd,
+                       atomic_bool *stop,
+                       size_t *bs) {
+    size_t nl = nd->nl;
+    
+    *bs = 0;
+    if (nl == 0 || nl > hl) return NULL;
+    if (nl == 1) return scalar_find(h, hl, nd, stop, bs);
+    
+    const char *h1 = h + nd->i1;
+    const char *h2 = h + nd->i2;
+    __m128i fv = _mm_load_si128((const __m128i*)nd->v1);
+    __m128i sv = _mm_load_si128((const __m128i*)nd->v2);
+    __m128i ff = _mm_load_si128((const __m128i*)nd->f1);
+    __m128i sf = _mm_load_si128((const __m128i*)nd->f2);
+    
+    size_t ii = 0;
+    size_t cc = 0;
+    
+    for (; ii + 63 + nl <= hl; ii += 64) {
+        if (++cc >= 16) {
+            if (stop && atomic_load_explicit(stop, memory_order_relaxed)) {
+                *bs = ii;
+                return NULL;
+            }
+            cc = 0;
+        }
+        
+        uint64_t m = 0;
+        for (int k = 0; k < 4; k++) {
+            __m128i v = _mm_or_si128(_mm_loadu_si128((const __m128i*)(h1 + ii + 16 * k)), ff);
+            __m128i w = _mm_or_si128(_mm_loadu_si128((const __m128i*)(h2 + ii + 16 * k)), sf);
+            __m128i c = _mm_and_si128(_mm_cmpeq_epi8(v, fv), _mm_cmpeq_epi8(w, sv));
+            m |= (uint64_t)(uint16_t)_mm_movemask_epi8(c) << (16 * k);
+        }
+        
+        if (m) {
+            const char *f = check_mask(h, ii, m, nd, bs);
+            if (f) return f;
+        }
+        
+        if (ii + 1024 < hl) {
+            _mm_prefetch(h + ii + 1024, _MM_HINT_T0);
+        }
+    }
+    
+    return tail_find(h, hl, ii, nd, bs);
+}
+
+__attribute__((target("avx2")))
 const char *avx_find(const char *h, size_t hl,
-                     const char *n, size_t nl,
-                     atomic_ullong *sc,
+                     const FsNeedle *nd,
                      atomic_bool *stop,
                      size_t *bs) {
-    if (nl == 0 || nl > hl) return NULL;
-    if (nl == 1) return memchr(h, n[0], hl);
+    size_t nl = nd->nl;
     
-    unsigned int nf = 0;
-    size_t cl = nl < 4 ? nl : 4;
-    memcpy(&nf, n, cl);
+    *bs = 0;
+    if (nl == 0 || nl > hl) return NULL;
+    if (nl == 1) return scalar_find(h, hl, nd, stop, bs);
     
-    __m256i fv = _mm256_set1_epi8(n[0]);
-    __m256i sv = _mm256_set1_epi8(n[1]);
+    const char *h1 = h + nd->i1;
+    const char *h2 = h + nd->i2;
+    __m256i fv = _mm256_load_si256((const __m256i*)nd->v1);
+    __m256i sv = _mm256_load_si256((const __m256i*)nd->v2);
+    __m256i ff = _mm256_load_si256((const __m256i*)nd->f1);
+    __m256i sf = _mm256_load_si256((const __m256i*)nd->f2);
     
     size_t ii = 0;
-    size_t lb = 0;
     size_t cc = 0;
     
-    for (; ii + 128 <= hl; ii += 32) {
+    for (; ii + 127 + nl <= hl; ii += 128) {
         if (++cc >= 8) {
-            if (stop && atomic_load(stop)) {
-                *bs = lb;
+            if (stop && atomic_load_explicit(stop, memory_order_relaxed)) {
+                *bs = ii;
                 return NULL;
             }
             cc = 0;
         }
         
-        __m256i v1 = _mm256_loadu_si256((const __m256i*)(h + ii));
-        __m256i v2 = _mm256_loadu_si256((const __m256i*)(h + ii + 32));
-        __m256i v3 = _mm256_loadu_si256((const __m256i*)(h + ii + 64));
-        __m256i v4 = _mm256_loadu_si256((const __m256i*)(h + ii + 96));
+        __m256i v1 = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(h1 + ii)), ff);
+        __m256i v2 = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(h1 + ii + 32)), ff);
+        __m256i v3 = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(h1 + ii + 64)), ff);
+        __m256i v4 = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(h1 + ii + 96)), ff);
         
         __m256i c1 = _mm256_cmpeq_epi8(v1, fv);
         __m256i c2 = _mm256_cmpeq_epi8(v2, fv);
         __m256i c3 = _mm256_cmpeq_epi8(v3, fv);
         __m256i c4 = _mm256_cmpeq_epi8(v4, fv);
         
-        if (nl > 1) {
-            __m256i n1 = _mm256_loadu_si256((const __m256i*)(h + ii + 1));
-            __m256i n2 = _mm256_loadu_si256((const __m256i*)(h + ii + 33));
-            __m256i n3 = _mm256_loadu_si256((const __m256i*)(h + ii + 65));
-            __m256i n4 = _mm256_loadu_si256((const __m256i*)(h + ii + 97));
-            
-            c1 = _mm256_and_si256(c1, _mm256_cmpeq_epi8(n1, sv));
-            c2 = _mm256_and_si256(c2, _mm256_cmpeq_epi8(n2, sv));
-            c3 = _mm256_and_si256(c3, _mm256_cmpeq_epi8(n3, sv));
-            c4 = _mm256_and_si256(c4, _mm256_cmpeq_epi8(n4, sv));
-        }
+        __m256i n1 = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(h2 + ii)), sf);
+        __m256i n2 = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(h2 + ii + 32)), sf);
+        __m256i n3 = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(h2 + ii + 64)), sf);
+        __m256i n4 = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(h2 + ii + 96)), sf);
         
-        int m1 = _mm256_movemask_epi8(c1);
-        int m2 = _mm256_movemask_epi8(c2);
-        int m3 = _mm256_movemask_epi8(c3);
-        int m4 = _mm256_movemask_epi8(c4);
+        c1 = _mm256_and_si256(c1, _mm256_cmpeq_epi8(n1, sv));
+        c2 = _mm256_and_si256(c2, _mm256_cmpeq_epi8(n2, sv));
+        c3 = _mm256_and_si256(c3, _mm256_cmpeq_epi8(n3, sv));
+        c4 = _mm256_and_si256(c4, _mm256_cmpeq_epi8(n4, sv));
         
-        while (m1) {
-            int p = __builtin_ctz(m1);
-            size_t idx = ii + p;
-            
-            unsigned int hf = 0;
-            memcpy(&hf, h + idx, cl);
-            
-            if (hf == nf && memcmp(h + idx, n, nl) == 0) {
-                *bs = lb + idx;
-                return h + idx;
-            }
-            
-            m1 &= m1 - 1;
+        uint64_t m12 = (uint32_t)_mm256_movemask_epi8(c1) |
+                       (uint64_t)(uint32_t)_mm256_movemask_epi8(c2) << 32;
+        uint64_t m34 = (uint32_t)_mm256_movemask_epi8(c3) |
+                       (uint64_t)(uint32_t)_mm256_movemask_epi8(c4) << 32;
+        
+        if (m12) {
+            const char *f = check_mask(h, ii, m12, nd, bs);
+            if (f) return f;
         }
         
-        while (m2) {
-            int p = __builtin_ctz(m2);
-            size_t idx = ii + 32 + p;
-            
-            unsigned int hf = 0;
-            memcpy(&hf, h + idx, cl);
-            
-            if (hf == nf && memcmp(h + idx, n, nl) == 0) {
-                *bs = lb + idx;
-                return h + idx;
-            }
-            
-            m2 &= m2 - 1;
+        if (m34) {
+            const char *f = check_mask(h, ii + 64, m34, nd, bs);
+            if (f) return f;
         }
         
-        while (m3) {
-            int p = __builtin_ctz(m3);
-            size_t idx = ii + 64 + p;
-            
-            unsigned int hf = 0;
-            memcpy(&hf, h + idx, cl);
-            
-            if (hf == nf && memcmp(h + idx, n, nl) == 0) {
-                *bs = lb + idx;
-                return h + idx;
+        if (ii + 1024 < hl) {
+            _mm_prefetch(h + ii + 1024, _MM_HINT_T0);
+        }
+    }
+    
+    return tail_find(h, hl, ii, nd, bs);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+const char *avx512_find(const char *h, size_t hl,
+                        const FsNeedle *nd,
+                        atomic_bool *stop,
+                        size_t *bs) {
+    size_t nl = nd->nl;
+    
+    *bs = 0;
+    if (nl == 0 || nl > hl) return NULL;
+    if (nl == 1) return scalar_find(h, hl, nd, stop, bs);
+    
+    const char *h1 = h + nd->i1;
+    const char *h2 = h + nd->i2;
+    __m512i fv = _mm512_load_si512((const void*)nd->v1);
+    __m512i sv = _mm512_load_si512((const void*)nd->v2);
+    __m512i ff = _mm512_load_si512((const void*)nd->f1);
+    __m512i sf = _mm512_load_si512((const void*)nd->f2);
+    
+    size_t ii = 0;
+    size_t cc = 0;
+    
+    for (; ii + 127 + nl <= hl; ii += 128) {
+        if (++cc >= 8) {
+            if (stop && atomic_load_explicit(stop, memory_order_relaxed)) {
+                *bs = ii;
+                return NULL;
             }
-            
-            m3 &= m3 - 1;
+            cc = 0;
         }
         
-        while (m4) {
-            int p = __builtin_ctz(m4);
-            size_t idx = ii + 96 + p;
-            
-            unsigned int hf = 0;
-            memcpy(&hf, h + idx, cl);
-            
-            if (hf == nf && memcmp(h + idx, n, nl) == 0) {
-                *bs = lb + idx;
-                return h + idx;
-            }
-            
-            m4 &= m4 - 1;
+        __m512i v1 = _mm512_or_si512(_mm512_loadu_si512((const void*)(h1 + ii)), ff);
+        __m512i v2 = _mm512_or_si512(_mm512_loadu_si512((const void*)(h1 + ii + 64)), ff);
+        __m512i n1 = _mm512_or_si512(_mm512_loadu_si512((const void*)(h2 + ii)), sf);
+        __m512i n2 = _mm512_or_si512(_mm512_loadu_si512((const void*)(h2 + ii + 64)), sf);
+        
+        __mmask64 k1 = _mm512_cmpeq_epi8_mask(v1, fv);
+        __mmask64 k2 = _mm512_cmpeq_epi8_mask(v2, fv);
+        k1 = _mm512_mask_cmpeq_epi8_mask(k1, n1, sv);
+        k2 = _mm512_mask_cmpeq_epi8_mask(k2, n2, sv);
+        
+        if (k1) {
+            const char *f = check_mask(h, ii, k1, nd, bs);
+            if (f) return f;
         }
         
-        lb += 128;
+        if (k2) {
+            const char *f = check_mask(h, ii + 64, k2, nd, bs);
+            if (f) return f;
+        }
         
         if (ii + 1024 < hl) {
             _mm_prefetch(h + ii + 1024, _MM_HINT_T0);
         }
     }
     
-    for (; ii < hl; ii++) {
-        if (h[ii] == n[0]) {
-            if (memcmp(h + ii, n, nl) == 0) {
-                *bs = lb + ii;
-                return h + ii;
+    return tail_find(h, hl, ii, nd, bs);
+}
+
+const FsFindFn fs_kernels[] = {
+    NULL,
+    scalar_find,
+    sse42_find,
+    avx_find,
+    avx512_find,
+};
+
+const char *fs_kernel_names[] = {
+    "auto",
+    "scalar",
+    "sse4.2",
+    "avx2",
+    "avx512bw",
+};
+
+
+int flashsearch_kernel_supported(int k) {
+    switch (k) {
+    case FS_KERNEL_AUTO:
+    case FS_KERNEL_SCALAR:
+        return 1;
+    case FS_KERNEL_SSE42:
+        return __builtin_cpu_supports("sse4.2");
+    case FS_KERNEL_AVX2:
+        return __builtin_cpu_supports("avx2");
+    case FS_KERNEL_AVX512:
+        return __builtin_cpu_supports("avx512f") &&
+               __builtin_cpu_supports("avx512bw");
+    }
+    return 0;
+}
+
+int best_kernel(void) {
+    for (int k = FS_KERNEL_AVX512; k > FS_KERNEL_SCALAR; k--) {
+        if (flashsearch_kernel_supported(k)) return k;
+    }
+    return FS_KERNEL_SCALAR;
+}
+
+int flashsearch_set_kernel(int k) {
+    if (k < FS_KERNEL_AUTO || k > FS_KERNEL_AVX512) return -1;
+    if (!flashsearch_kernel_supported(k)) return -1;
+    if (k == FS_KERNEL_AUTO) k = best_kernel();
+    
+    fs_kernel_id = k;
+    fs_find_fn = fs_kernels[k];
+    return 0;
+}
+
+int flashsearch_kernel(void) {
+    return fs_kernel_id;
+}
+
+const char *flashsearch_kernel_name(int k) {
+    if (k < FS_KERNEL_AUTO || k > FS_KERNEL_AVX512) return "unknown";
+    return fs_kernel_names[k];
+}
+
+__attribute__((constructor))
+void kernel_init(void) {
+    __builtin_cpu_init();
+    flashsearch_reset_freq();
+    
+    int k = best_kernel();
+    
+    const char *env = getenv("FLASHSEARCH_KERNEL");
+    if (env) {
+        for (int i = FS_KERNEL_SCALAR; i <= FS_KERNEL_AVX512; i++) {
+            if (!strcmp(env, fs_kernel_names[i]) && flashsearch_kernel_supported(i)) {
+                k = i;
             }
         }
     }
     
-    *bs = lb + hl;
-    return NULL;
+    flashsearch_set_kernel(k);
+}
+
+const char *needle_find(const char *h, size_t hl,
+                        const FsNeedle *nd,
+                        atomic_bool *stop,
+                        size_t *bs) {
+    return nd->find(h, hl, nd, stop, bs);
 }
 
 typedef struct {
-    Worker *ws;
-    int nw;
-    atomic_bool found;
-    atomic_bool stop;
-    const char *res;
+    FsPool *pool;
+    int id;
+} PoolSlot;
+
+struct FsPool {
+    int n;
+    pthread_t th[MAX_THREADS];
+    PoolSlot sl[MAX_THREADS];
+    pthread_mutex_t run;
     pthread_mutex_t mtx;
-} Stealer;
+    pthread_cond_t go;
+    pthread_cond_t done;
+    unsigned long gen;
+    int act;
+    int busy;
+    int quit;
+    void *(*fn)(void*);
+    char *args;
+    size_t sz;
+    void **rets;
+};
 
-void *worker_no_overlap(void *arg) {
-    Worker *w = (Worker*)arg;
-    Stealer *s = (Stealer*)w->kill;
-    
+void pin_cpu(pthread_attr_t *at, int i, int t) {
     cpu_set_t cs;
     CPU_ZERO(&cs);
-    static int cid = 0;
-    int nc = sysconf(_SC_NPROCESSORS_ONLN);
-    CPU_SET(cid++ % nc, &cs);
-    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cs);
+    CPU_SET(numa_cpu(i, t), &cs);
+    pthread_attr_setaffinity_np(at, sizeof(cpu_set_t), &cs);
+}
+
+void *pool_main(void *arg) {
+    PoolSlot *sl = (PoolSlot*)arg;
+    FsPool *p = sl->pool;
+    unsigned long seen = 0;
     
-    size_t ch = (w->end - w->start) / 16;
-    if (ch < 1024 * 1024) ch = 1024 * 1024;
+    pthread_mutex_lock(&p->mtx);
+    for (;;) {
+        while (p->gen == seen && !p->quit) {
+            pthread_cond_wait(&p->go, &p->mtx);
+        }
+        if (p->quit) break;
+        
+        seen = p->gen;
+        if (sl->id >= p->act) continue;
+        
+        void *(*fn)(void*) = p->fn;
+        void *a = p->args + sl->id * p->sz;
+        pthread_mutex_unlock(&p->mtx);
+        
+        void *r = fn(a);
+        
+        pthread_mutex_lock(&p->mtx);
+        if (p->rets) p->rets[sl->id] = r;
+        if (--p->busy == 0) pthread_cond_signal(&p->done);
+    }
+    pthread_mutex_unlock(&p->mtx);
     
-    while (!atomic_load(&s->stop)) {
-        size_t ci = __sync_fetch_and_add(&w->pos, 1);
-        if (ci >= 16) break;
+    return NULL;
+}
+
+FsPool *flashsearch_pool_create(int threads) {
+    if (threads < 1) threads = 1;
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+    
+    FsPool *p = calloc(1, sizeof(FsPool));
+    if (!p) return NULL;
+    
+    pthread_mutex_init(&p->run, NULL);
+    pthread_mutex_init(&p->mtx, NULL);
+    pthread_cond_init(&p->go, NULL);
+    pthread_cond_init(&p->done, NULL);
+    
+    for (int i = 0; i < threads; i++) {
+        p->sl[i].pool = p;
+        p->sl[i].id = i;
         
-        size_t cs = w->start + ci * ch;
-        size_t ce = cs + ch;
-        if (ce > w->end) ce = w->end;
-        if (cs >= ce) continue;
+        pthread_attr_t at;
+        pthread_attr_init(&at);
+        pin_cpu(&at, i, threads);
+        int rc = pthread_create(&p->th[i], &at, pool_main, &p->sl[i]);
+        pthread_attr_destroy(&at);
         
-        size_t bs = 0;
-        const char *f = avx_find(w->data + cs, 
-                                 ce - cs,
-                                 w->pattern, w->pattern_len,
-                                 w->scanned, 
-                                 &s->stop,
-                                 &bs);
-        
-        if (w->scanned) atomic_fetch_add(w->scanned, bs);
-        
-        if (f) {
-            atomic_store(&s->stop, true);
-            atomic_store(&s->found, true);
+        if (rc != 0) break;
+        p->n++;
+    }
+    
+    if (p->n == 0) {
+        flashsearch_pool_destroy(p);
+        return NULL;
+    }
+    
+    return p;
+}
+
+void flashsearch_pool_destroy(FsPool *p) {
+    if (!p) return;
+    
+    pthread_mutex_lock(&p->mtx);
+    p->quit = 1;
+    pthread_cond_broadcast(&p->go);
+    pthread_mutex_unlock(&p->mtx);
+    
+    for (int i = 0; i < p->n; i++) {
+        pthread_join(p->th[i], NULL);
+    }
+    
+    pthread_cond_destroy(&p->done);
+    pthread_cond_destroy(&p->go);
+    pthread_mutex_destroy(&p->mtx);
+    pthread_mutex_destroy(&p->run);
+    free(p);
+}
+
+int flashsearch_pool_threads(const FsPool *p) {
+    return p ? p->n : 0;
+}
+
+void run_workers(FsPool *pool, int t, void *(*fn)(void*),
+                 void *args, size_t sz, void **rets) {
+    if (pool) {
+        pthread_mutex_lock(&pool->run);
+        pthread_mutex_lock(&pool->mtx);
+        pool->fn = fn;
+        pool->args = (char*)args;
+        pool->sz = sz;
+        pool->rets = rets;
+        pool->act = t;
+        pool->busy = t;
+        pool->gen++;
+        pthread_cond_broadcast(&pool->go);
+        while (pool->busy > 0) {
+            pthread_cond_wait(&pool->done, &pool->mtx);
+        }
+        pool->rets = NULL;
+        pthread_mutex_unlock(&pool->mtx);
+        pthread_mutex_unlock(&pool->run);
+        return;
+    }
+    
+    if (t == 1) {
+        void *r = fn(args);
+        if (rets) rets[0] = r;
+        return;
+    }
+    
+    pthread_t pts[MAX_THREADS];
+    bool ok[MAX_THREADS];
+    
+    for (int i = 0; i < t; i++) {
+        pthread_attr_t at;
+        pthread_attr_init(&at);
+        pin_cpu(&at, i, t);
+        ok[i] = pthread_create(&pts[i], &at, fn, (char*)args + i * sz) == 0;
+        pthread_attr_destroy(&at);
+        
+        if (!ok[i]) {
+            void *r = fn((char*)args + i * sz);
+            if (rets) rets[i] = r;
+        }
+    }
+    
+    for (int i = 0; i < t; i++) {
+        if (!ok[i]) continue;
+        void *r;
+        pthread_join(pts[i], &r);
+        if (rets) rets[i] = r;
+    }
+}
+
+void ctx_begin(Context *ctx) {
+    if (!ctx) return;
+    atomic_store(&ctx->found, false);
+    atomic_store(&ctx->position, 0);
+    ctx->result = NULL;
+    atomic_store(&ctx->bytes_scanned, 0);
+    memset(&ctx->stats, 0, sizeof(ctx->stats));
+    atomic_store(&ctx->cycles_end, 0);
+    atomic_store(&ctx->cycles_start, rdtsc());
+}
+
+void ctx_end(Context *ctx, const char *d, const char *res) {
+    if (!ctx) return;
+    if (res) {
+        atomic_store(&ctx->found, true);
+        ctx->result = res;
+        atomic_store(&ctx->position, res - d);
+    }
+    atomic_store(&ctx->cycles_end, rdtsc());
+}
+
+void stats_add(Context *ctx, int i, const FsThreadStats *s) {
+    if (!ctx || i < 0 || i >= MAX_THREADS) return;
+    
+    FsThreadStats *p = &ctx->stats.per[i];
+    FsThreadStats *a = &ctx->stats.sum;
+    
+    p->bytes += s->bytes;
+    p->candidates += s->candidates;
+    p->false_positives += s->false_positives;
+    p->chunks += s->chunks;
+    p->steals += s->steals;
+    p->stall_cycles += s->stall_cycles;
+    
+    a->bytes += s->bytes;
+    a->candidates += s->candidates;
+    a->false_positives += s->false_positives;
+    a->chunks += s->chunks;
+    a->steals += s->steals;
+    a->stall_cycles += s->stall_cycles;
+    
+    if (i >= ctx->stats.threads) ctx->stats.threads = i + 1;
+    atomic_fetch_add(&ctx->bytes_scanned, s->bytes);
+}
+
+void stats_bytes(Context *ctx, int i, size_t n) {
+    FsThreadStats s = {0};
+    s.bytes = n;
+    stats_add(ctx, i, &s);
+}
+
+void stats_first(Context *ctx, unsigned long long at) {
+    if (!ctx || !at) return;
+    unsigned long long c0 = atomic_load(&ctx->cycles_start);
+    ctx->stats.first_match_cycles = at > c0 ? at - c0 : 0;
+}
+
+typedef struct {
+    atomic_ullong range;
+    atomic_size_t cur;
+    atomic_bool stop;
+} __attribute__((aligned(64))) Deque;
+
+typedef struct {
+    Worker *ws;
+    int nw;
+    size_t ch;
+    atomic_size_t best;
+    atomic_ullong first;
+    Deque dq[MAX_THREADS];
+    FsThreadStats ts[MAX_THREADS];
+} Stealer;
+
+#define DQ_PACK(h, t) (((unsigned long long)(h) << 32) | (unsigned)(t))
+
+int deque_pop(Deque *q, size_t *ci) {
+    unsigned long long r = atomic_load(&q->range);
+    
+    for (;;) {
+        unsigned h = r >> 32, t = (unsigned)r;
+        if (h >= t) return 0;
+        if (atomic_compare_exchange_weak(&q->range, &r, DQ_PACK(h + 1, t))) {
+            *ci = h;
+            return 1;
+        }
+    }
+}
+
+int deque_steal(Stealer *s, int me) {
+    for (int k = 1; k < s->nw; k++) {
+        Deque *v = &s->dq[(me + k) % s->nw];
+        unsigned long long r = atomic_load(&v->range);
+        
+        for (;;) {
+            unsigned h = r >> 32, t = (unsigned)r;
+            if (h >= t) break;
             
-            pthread_mutex_lock(&s->mtx);
-            if (s->res == NULL) {
-                s->res = f;
+            unsigned m = t - (t - h + 1) / 2;
+            if (atomic_compare_exchange_weak(&v->range, &r, DQ_PACK(h, m))) {
+                atomic_store(&s->dq[me].range, DQ_PACK(m, t));
+                return 1;
             }
-            pthread_mutex_unlock(&s->mtx);
-            
-            return (void*)f;
         }
+    }
+    
+    return 0;
+}
+
+size_t steal_chunk(size_t l, size_t pl, int t) {
+    size_t lo = 64 * 1024;
+    if (pl * 256 > lo) lo = pl * 256;
+    
+    size_t ch = l / ((size_t)t * 32);
+    if (ch > 8 * 1024 * 1024) ch = 8 * 1024 * 1024;
+    if (ch < lo) ch = lo;
+    
+    return (ch + 4095) & ~(size_t)4095;
+}
+
+void publish_hit(Stealer *s, size_t pos) {
+    unsigned long long z = 0;
+    atomic_compare_exchange_strong(&s->first, &z, rdtsc());
+    
+    size_t b = atomic_load(&s->best);
+    while (pos < b && !atomic_compare_exchange_weak(&s->best, &b, pos));
+    
+    for (int j = 0; j < s->nw; j++) {
+        if (atomic_load(&s->dq[j].cur) > pos) atomic_store(&s->dq[j].stop, true);
+    }
+}
+
+const char *scan_span(Worker *w, size_t at, size_t lim, size_t se,
+                      atomic_bool *stop) {
+    while (at < lim) {
+        size_t bs = 0;
+        const char *f = needle_find(w->data + at, 
+                                    se - at,
+                                    w->needle,
+                                    stop,
+                                    &bs);
         
-        if (atomic_load(&s->found)) {
-            return NULL;
-        }
+        if (w->stats) w->stats->bytes += bs;
+        
+        if (!f || (size_t)(f - w->data) >= lim) return NULL;
+        if (!w->check || w->check(w, f - w->data)) return f;
+        
+        at = f - w->data + 1;
     }
     
     return NULL;
 }
 
-const char *flashsearch_ultimate_no_overlap(const char *d, size_t l,
-                                           const char *p, size_t pl,
-                                           int t, Context *ctx) {
-    if (t < 1) t = 1;
-    if (t > 32) t = 32;
-    if (pl == 0 || pl > 256) return NULL;
+const char *scan_seam(Worker *w, size_t cs, size_t ce, atomic_bool *stop) {
+    size_t pl = w->pattern_len;
+    if (pl < 2 || ce >= w->len) return NULL;
+    
+    size_t a = ce - cs > pl - 1 ? ce - (pl - 1) : cs;
+    size_t se = w->len - ce > pl - 1 ? ce + (pl - 1) : w->len;
+    
+    return scan_span(w, a, ce, se, stop);
+}
+
+void *worker_no_overlap(void *arg) {
+    Worker *w = (Worker*)arg;
+    Stealer *s = (Stealer*)w->kill;
+    int me = w - s->ws;
+    Deque *q = &s->dq[me];
+    FsThreadStats *ts = &s->ts[me];
+    unsigned long long c0 = fs_tl_cand, m0 = fs_tl_miss;
+    size_t ci;
     
-    if (ctx) {
-        atomic_store(&ctx->found, false);
-        ctx->result = NULL;
-        atomic_store(&ctx->bytes_scanned, 0);
-        atomic_store(&ctx->cycles_start, rdtsc());
+    for (;;) {
+        if (!deque_pop(q, &ci)) {
+            if (!deque_steal(s, me)) break;
+            ts->steals++;
+            if (!deque_pop(q, &ci)) continue;
+        }
+        ts->chunks++;
+        
+        size_t cs = ci * s->ch;
+        size_t ce = cs + s->ch;
+        if (ce > w->len) ce = w->len;
+        
+        atomic_store(&q->cur, cs);
+        atomic_store(&q->stop, false);
+        if (cs >= atomic_load(&s->best)) continue;
+        if (ce < w->len) file_ahead(w->data + ce, s->ch);
+        
+        const char *f;
+        for (;;) {
+            f = scan_span(w, cs, ce, ce, &q->stop);
+            if (!f) f = scan_seam(w, cs, ce, &q->stop);
+            if (f || !atomic_load(&q->stop) || cs >= atomic_load(&s->best)) break;
+            atomic_store(&q->stop, false);
+        }
+        
+        if (f) publish_hit(s, f - w->data);
     }
     
-    Stealer st;
-    atomic_store(&st.found, false);
-    atomic_store(&st.stop, false);
-    st.res = NULL;
-    pthread_mutex_init(&st.mtx, NULL);
+    ts->candidates = fs_tl_cand - c0;
+    ts->false_positives = fs_tl_miss - m0;
     
-    Worker ws[32];
-    pthread_t pts[32];
+    unsigned long long t1 = rdtsc(), first = atomic_load(&s->first);
+    ts->stall_cycles = first && t1 > first ? t1 - first : 0;
     
-    size_t ch = l / t;
+    return NULL;
+}
+
+const char *search_needle(FsPool *pool,
+                          const char *d, size_t l,
+                          const FsNeedle *nd, int t,
+                          FsCheckFn check, void *args, size_t argsz,
+                          Context *ctx) {
+    ctx_begin(ctx);
+    
+    Worker ws[MAX_THREADS];
+    
+    Stealer st;
+    st.ws = ws;
+    st.nw = t;
+    st.ch = steal_chunk(l, nd->nl, t);
+    atomic_store(&st.best, SIZE_MAX);
+    atomic_store(&st.first, 0);
+    memset(st.ts, 0, sizeof(st.ts));
+    
+    size_t nch = (l + st.ch - 1) / st.ch;
     
     for (int i = 0; i < t; i++) {
+        size_t h = nch * i / t;
+        size_t e = nch * (i + 1) / t;
+        
+        atomic_store(&st.dq[i].range, DQ_PACK(h, e));
+        atomic_store(&st.dq[i].cur, 0);
+        atomic_store(&st.dq[i].stop, false);
+        
         ws[i].data = d;
-        ws[i].pattern = p;
-        ws[i].pattern_len = pl;
+        ws[i].len = l;
+        ws[i].pattern = nd->n;
+        ws[i].pattern_len = nd->nl;
+        ws[i].needle = nd;
         ws[i].kill = (atomic_bool*)&st;
-        ws[i].scanned = ctx ? &ctx->bytes_scanned : NULL;
+        ws[i].stats = &st.ts[i];
         
-        ws[i].start = i * ch;
-        ws[i].end = (i == t - 1) ? l : (i + 1) * ch;
+        ws[i].start = h * st.ch < l ? h * st.ch : l;
+        ws[i].end = e * st.ch < l ? e * st.ch : l;
         
         ws[i].pos = 0;
         
-        pthread_create(&pts[i], NULL, worker_no_overlap, &ws[i]);
+        ws[i].check = check;
+        ws[i].arg = args ? (char*)args + i * argsz : NULL;
     }
     
-    for (int i = 0; i < t; i++) {
-        void *tr;
-        pthread_join(pts[i], &tr);
-        
-        if (tr && st.res == NULL) {
-            st.res = (const char*)tr;
-        }
-    }
+    run_workers(pool, t, worker_no_overlap, ws, sizeof(Worker), NULL);
     
-    pthread_mutex_destroy(&st.mtx);
+    for (int i = 0; i < t; i++) stats_add(ctx, i, &st.ts[i]);
+    stats_first(ctx, atomic_load(&st.first));
     
-    if (st.res && ctx) {
-        atomic_store(&ctx->found, true);
-        ctx->result = st.res;
-        atomic_store(&ctx->position, st.res - d);
-        atomic_store(&ctx->cycles_end, rdtsc());
+    size_t b = atomic_load(&st.best);
+    const char *res = b == SIZE_MAX ? NULL : d + b;
+    
+    ctx_end(ctx, d, res);
+    
+    return res;
+}
+
+const char *search_first(FsPool *pool,
+                         const char *d, size_t l,
+                         const char *p, size_t pl, int t,
+                         FsCheckFn check, void *args, size_t argsz,
+                         Context *ctx) {
+    if (pool && t > pool->n) t = pool->n;
+    if (t < 1) t = 1;
+    if (t > MAX_THREADS) t = MAX_THREADS;
+    if (pl == 0) return NULL;
+    
+    FsNeedle nd;
+    needle_init(&nd, p, pl, 0);
+    
+    return search_needle(pool, d, l, &nd, t, check, args, argsz, ctx);
+}
+
+FsPattern *flashsearch_pattern_compile(const char *p, size_t pl, int flags) {
+    if (!p || pl == 0) return NULL;
+    
+    FsPattern *c = aligned_alloc(64, (sizeof(FsPattern) + 63) & ~(size_t)63);
+    if (!c) return NULL;
+    
+    memset(c, 0, sizeof(FsPattern));
+    c->buf = malloc(pl);
+    if (!c->buf) {
+        free(c);
+        return NULL;
     }
     
-    return st.res;
+    memcpy(c->buf, p, pl);
+    c->flags = flags;
+    needle_init(&c->nd, c->buf, pl, flags);
+    
+    return c;
+}
+
+void flashsearch_pattern_free(FsPattern *c) {
+    if (!c) return;
+    free(c->buf);
+    free(c);
+}
+
+int flashsearch_pattern_kernel(const FsPattern *c) {
+    return c ? c->nd.kernel : -1;
+}
+
+const char *flashsearch_search_compiled(const FsPattern *c, FsPool *pool,
+                                        const char *d, size_t l,
+                                        int t, Context *ctx) {
+    if (!c) return NULL;
+    
+    t = find_threads(pool, t);
+    return search_needle(pool, d, l, &c->nd, t, NULL, NULL, 0, ctx);
+}
+
+const char *flashsearch_ultimate_no_overlap(FsPool *pool,
+                                           const char *d, size_t l,
+                                           const char *p, size_t pl,
+                                           int t, Context *ctx) {
+    return search_first(pool, d, l, p, pl, t, NULL, NULL, 0, ctx);
+}
+
+const char *flashsearch_raw(const char *d, size_t l,
+                           const char *p, size_t pl,
+                           int t, Context *ctx) {
+    return search_first(NULL, d, l, p, pl, t, NULL, NULL, 0, ctx);
 }
 
 const char *flashsearch_hyper(const char *d, size_t l,
                              const char *p, size_t pl,
                              int t, Context *ctx) {
-    return flashsearch_ultimate_no_overlap(d, l, p, pl, t, ctx);
+    return flashsearch_ultimate_no_overlap(NULL, d, l, p, pl, t, ctx);
+}
+
+const char *flashsearch_hyper_icase(const char *d, size_t l,
+                                   const char *p, size_t pl,
+                                   int t, Context *ctx) {
+    if (t < 1) t = 1;
+    if (t > MAX_THREADS) t = MAX_THREADS;
+    if (pl == 0) return NULL;
+    
+    FsNeedle nd;
+    needle_init(&nd, p, pl, FS_ICASE);
+    
+    return search_needle(NULL, d, l, &nd, t, NULL, NULL, 0, ctx);
 }
 
 const char *flashsearch_ultimate(const char *d, size_t l,
                                 const char *p, size_t pl,
                                 int t, Context *ctx) {
-    return flashsearch_ultimate_no_overlap(d, l, p, pl, t, ctx);
+    return flashsearch_ultimate_no_overlap(NULL, d, l, p, pl, t, ctx);
+}
+
+const char *flashsearch_hyper_pool(FsPool *pool, const char *d, size_t l,
+                                  const char *p, size_t pl, Context *ctx) {
+    if (!pool) return NULL;
+    return flashsearch_ultimate_no_overlap(pool, d, l, p, pl, pool->n, ctx);
+}
+
+const char *flashsearch_ultimate_pool(FsPool *pool, const char *d, size_t l,
+                                     const char *p, size_t pl, Context *ctx) {
+    if (!pool) return NULL;
+    return flashsearch_ultimate_no_overlap(pool, d, l, p, pl, pool->n, ctx);
+}
+
+int hits_push(Hits *hs, size_t v) {
+    if (hs->n == hs->cap) {
+        size_t nc = hs->cap ? hs->cap * 2 : 1024;
+        size_t *nv = realloc(hs->v, nc * sizeof(size_t));
+        if (!nv) return -1;
+        hs->v = nv;
+        hs->cap = nc;
+    }
+    hs->v[hs->n++] = v;
+    return 0;
+}
+
+int collect_span(Collector *c, size_t i, size_t lim, size_t se) {
+    size_t pl = c->needle->nl;
+    
+    while (i < lim && i + pl <= se) {
+        size_t bs = 0;
+        const char *f = needle_find(c->data + i, se - i,
+                                    c->needle, NULL, &bs);
+        if (!f) break;
+        
+        size_t pos = f - c->data;
+        if (pos >= lim) break;
+        
+        if (hits_push(&c->hits, pos) < 0) return -1;
+        i = pos + 1;
+    }
+    
+    return 0;
+}
+
+void *worker_all(void *arg) {
+    Collector *c = (Collector*)arg;
+    size_t pl = c->needle->nl;
+    
+    unsigned long long c0 = fs_tl_cand, m0 = fs_tl_miss;
+    
+    c->hits.n = 0;
+    memset(&c->stats, 0, sizeof(c->stats));
+    c->stats.bytes = c->end - c->start;
+    c->stats.chunks = 1;
+    c->err = collect_span(c, c->start, c->end, c->end) < 0;
+    
+    if (!c->err && pl > 1 && c->end < c->len) {
+        size_t a = c->end - c->start > pl - 1 ? c->end - (pl - 1) : c->start;
+        size_t se = c->len - c->end > pl - 1 ? c->end + (pl - 1) : c->len;
+        c->stats.bytes += se - c->end;
+        c->err = collect_span(c, a, c->end, se) < 0;
+    }
+    
+    c->stats.candidates = fs_tl_cand - c0;
+    c->stats.false_positives = fs_tl_miss - m0;
+    
+    return NULL;
+}
+
+int collect_range(FsPool *pool, int t, Collector *cs,
+                  const char *d, size_t l, size_t rs, size_t re,
+                  const FsNeedle *nd, Context *ctx) {
+    size_t ch = (re - rs) / t;
+    
+    for (int i = 0; i < t; i++) {
+        cs[i].data = d;
+        cs[i].len = l;
+        cs[i].needle = nd;
+        cs[i].start = rs + i * ch;
+        cs[i].end = (i == t - 1) ? re : rs + (i + 1) * ch;
+    }
+    
+    run_workers(pool, t, worker_all, cs, sizeof(Collector), NULL);
+    
+    for (int i = 0; i < t; i++) {
+        stats_add(ctx, i, &cs[i].stats);
+        if (cs[i].err) return -1;
+    }
+    
+    return 0;
+}
+
+int find_threads(FsPool *pool, int t) {
+    if (pool && (t < 1 || t > pool->n)) t = pool->n;
+    if (t < 1) t = 1;
+    if (t > MAX_THREADS) t = MAX_THREADS;
+    return t;
+}
+
+long flashsearch_find_all(FsPool *pool, const char *d, size_t l,
+                          const char *p, size_t pl,
+                          int t, size_t **out, Context *ctx) {
+    if (out) *out = NULL;
+    if (!out) return -1;
+    
+    t = find_threads(pool, t);
+    ctx_begin(ctx);
+    
+    if (pl == 0 || pl > l) {
+        ctx_end(ctx, d, NULL);
+        return 0;
+    }
+    
+    FsNeedle nd;
+    needle_init(&nd, p, pl, 0);
+    
+    Collector cs[MAX_THREADS];
+    memset(cs, 0, sizeof(cs));
+    
+    long r = -1;
+    if (collect_range(pool, t, cs, d, l, 0, l, &nd, ctx) == 0) {
+        size_t tot = 0;
+        for (int i = 0; i < t; i++) tot += cs[i].hits.n;
+        
+        size_t *v = malloc((tot ? tot : 1) * sizeof(size_t));
+        if (v) {
+            size_t k = 0;
+            for (int i = 0; i < t; i++) {
+                if (cs[i].hits.n) memcpy(v + k, cs[i].hits.v, cs[i].hits.n * sizeof(size_t));
+                k += cs[i].hits.n;
+            }
+            *out = v;
+            r = (long)tot;
+        }
+    }
+    
+    for (int i = 0; i < t; i++) free(cs[i].hits.v);
+    
+    ctx_end(ctx, d, (r > 0) ? d + (*out)[0] : NULL);
+    return r;
+}
+
+long flashsearch_find_each(FsPool *pool, const char *d, size_t l,
+                           const char *p, size_t pl, int t,
+                           FsHitFn fn, void *arg, Context *ctx) {
+    if (!fn) return -1;
+    
+    t = find_threads(pool, t);
+    ctx_begin(ctx);
+    
+    if (pl == 0 || pl > l) {
+        ctx_end(ctx, d, NULL);
+        return 0;
+    }
+    
+    FsNeedle nd;
+    needle_init(&nd, p, pl, 0);
+    
+    Collector cs[MAX_THREADS];
+    memset(cs, 0, sizeof(cs));
+    
+    size_t rl = (size_t)t * FS_ROUND_BYTES;
+    long cnt = 0;
+    const char *first = NULL;
+    int quit = 0;
+    
+    for (size_t rs = 0; rs < l && !quit; rs += rl) {
+        size_t re = rs + rl < l ? rs + rl : l;
+        
+        if (collect_range(pool, t, cs, d, l, rs, re, &nd, ctx) < 0) {
+            cnt = -1;
+            break;
+        }
+        
+        for (int i = 0; i < t && !quit; i++) {
+            for (size_t k = 0; k < cs[i].hits.n; k++) {
+                size_t pos = cs[i].hits.v[k];
+                if (!first) first = d + pos;
+                cnt++;
+                if (fn(d + pos, pos, arg)) {
+                    quit = 1;
+                    break;
+                }
+            }
+        }
+    }
+    
+    for (int i = 0; i < t; i++) free(cs[i].hits.v);
+    
+    ctx_end(ctx, d, first);
+    return cnt;
 }
 
 double flashsearch_gbps(const Context *ctx, double ms) {
@@ -305,4 +1324,52 @@ void flashsearch_print(const Context *ctx, double ms, size_t total) {
     printf("Speed: %.1f GB/s\n", gb);
     printf("Cycles: %llu\n", c);
     if (b > 0) printf("Cycles/byte: %.1f\n", (double)c / b);
+    
+    const FsThreadStats *s = &ctx->stats.sum;
+    if (s->candidates) {
+        printf("Candidates: %llu (%.1f%% false)\n", s->candidates,
+               (s->false_positives * 100.0) / s->candidates);
+    }
+    if (s->chunks) printf("Chunks: %llu (%llu stolen)\n", s->chunks, s->steals);
+    if (ctx->stats.first_match_cycles) {
+        printf("First match: %llu cycles\n", ctx->stats.first_match_cycles);
+    }
+}
+
+int stats_fields(char *buf, size_t n, const FsThreadStats *s) {
+    return snprintf(buf, n,
+                    "\"bytes\":%llu,\"candidates\":%llu,\"false_positives\":%llu,"
+                    "\"chunks\":%llu,\"steals\":%llu,\"stall_cycles\":%llu",
+                    s->bytes, s->candidates, s->false_positives,
+                    s->chunks, s->steals, s->stall_cycles);
+}
+
+int flashsearch_stats_json(const Context *ctx, char *buf, size_t n) {
+    if (!ctx) return -1;
+    if (!buf) n = 0;
+    
+    char tmp[256];
+    size_t k = 0;
+    const FsStats *st = &ctx->stats;
+    unsigned long long c = atomic_load(&ctx->cycles_end) - atomic_load(&ctx->cycles_start);
+
+#define FS_EMIT(...) do { \
+        int r = snprintf(n ? buf + (k < n ? k : n - 1) : NULL, k < n ? n - k : 0, __VA_ARGS__); \
+        if (r < 0) return -1; \
+        k += r; \
+    } while (0)
+    
+    stats_fields(tmp, sizeof(tmp), &st->sum);
+    FS_EMIT("{\"threads\":%d,\"cycles\":%llu,\"first_match_cycles\":%llu,%s,\"per_thread\":[",
+            st->threads, c, st->first_match_cycles, tmp);
+    
+    for (int i = 0; i < st->threads; i++) {
+        stats_fields(tmp, sizeof(tmp), &st->per[i]);
+        FS_EMIT("%s{%s}", i ? "," : "", tmp);
+    }
+    FS_EMIT("]}");
+
+#undef FS_EMIT
+    
+    return (int)k;
 }
@@ -9,17 +9,83 @@
 #include <pthread.h>
 
 #define MAX_THREADS 32
-#define MAX_PATTERN 256
+#define FS_ROUND_BYTES (4 * 1024 * 1024)
+#define FS_STREAM_BLOCK (8 * 1024 * 1024)
+#define FS_STREAM_SLOTS 4
+#define FS_MAX_NODES 64
+#define FS_INDEX_BLOCK (256 * 1024)
+#define FS_INDEX_BITS (1 << 17)
+#define FS_INDEX_SPAN 64
+#define FS_BATCH_BLOCK (256 * 1024)
+#define FS_D_CORPORA 32
+
+#define FS_KERNEL_AUTO 0
+#define FS_KERNEL_SCALAR 1
+#define FS_KERNEL_SSE42 2
+#define FS_KERNEL_AVX2 3
+#define FS_KERNEL_AVX512 4
+
+#define FS_ICASE 1
+
+#define FS_OPEN_POPULATE 1
+#define FS_OPEN_DIRECT 2
+
+#define FS_FILE_MMAP 0
+#define FS_FILE_DIRECT 1
+#define FS_FILE_READ 2
+
+#define FS_GEN_PLANTS 64
+
+#define FS_TREE_HIDDEN 2
+#define FS_TREE_NO_IGNORE 4
+#define FS_TREE_BINARY 8
+#define FS_TREE_FIRST 16
+#define FS_TREE_FILTERS 32
+#define FS_TREE_SPLIT (8 * 1024 * 1024)
+
+#define FS_Q_FIRST 0
+#define FS_Q_ALL 1
+#define FS_Q_LINES 2
+#define FS_Q_LOOKUP 3
+
+#define FS_HUGE_NONE 0
+#define FS_HUGE_THP 1
+#define FS_HUGE_TLB 2
 
 typedef struct {
+    unsigned long long bytes;
+    unsigned long long candidates;
+    unsigned long long false_positives;
+    unsigned long long chunks;
+    unsigned long long steals;
+    unsigned long long stall_cycles;
+} __attribute__((aligned(64))) FsThreadStats;
+
+typedef struct Worker Worker;
+struct FsNeedle;
+
+typedef int (*FsCheckFn)(Worker *w, size_t pos);
+
+struct Worker {
     const char *data;
+    size_t len;
     size_t start, end;
     volatile size_t pos;
     const char *pattern;
     size_t pattern_len;
+    const struct FsNeedle *needle;
     atomic_bool *kill;
-    atomic_ullong *scanned;
-} Worker;
+    FsThreadStats *stats;
+    FsCheckFn check;
+    void *arg;
+};
+
+typedef struct {
+    int threads;
+    unsigned long long first_match_cycles;
+    FsThreadStats sum;
+    FsThreadStats per[MAX_THREADS];
+} FsStats;
 
 typedef struct {
     atomic_bool found;
@@ -28,8 +94,42 @@ typedef struct {
     atomic_ullong cycles_start;
     atomic_ullong cycles_end;
     atomic_ullong bytes_scanned;
+    FsStats stats;
 } Context;
 
+typedef struct FsPool FsPool;
+
+int flashsearch_kernel(void);
+int flashsearch_set_kernel(int kernel);
+int flashsearch_kernel_supported(int kernel);
+const char *flashsearch_kernel_name(int kernel);
+
+int flashsearch_numa_nodes(void);
+int flashsearch_numa_place(const void *data, size_t len);
+
+void flashsearch_learn_freq(const char *data, size_t len);
+void flashsearch_reset_freq(void);
+
+typedef int (*FsHitFn)(const char *hit, size_t pos, void *arg);
+
+typedef struct FsPattern FsPattern;
+
+#define FS_MULTI_TEDDY 0
+#define FS_MULTI_AC 1
+
+typedef struct FsMulti FsMulti;
+
+typedef struct {
+    size_t pos;
+    int id;
+} FsMatch;
+
+typedef int (*FsMultiFn)(const char *hit, size_t pos, int id, void *arg);
+
+FsPool *flashsearch_pool_create(int threads);
+void flashsearch_pool_destroy(FsPool *pool);
+int flashsearch_pool_threads(const FsPool *pool);
+
 const char *flashsearch_raw(const char *data, size_t len,
                            const char *pattern, size_t pattern_len,
                            int threads, Context *ctx);
@@ -50,7 +150,206 @@ const char *flashsearch_hyper(const char *data, size_t len,
                              const char *pattern, size_t pattern_len,
                              int threads, Context *ctx);
 
+const char *flashsearch_hyper_icase(const char *data, size_t len,
+                                   const char *pattern, size_t pattern_len,
+                                   int threads, Context *ctx);
+
+const char *flashsearch_hyper_pool(FsPool *pool, const char *data, size_t len,
+                                  const char *pattern, size_t pattern_len,
+                                  Context *ctx);
+
+const char *flashsearch_ultimate_pool(FsPool *pool, const char *data, size_t len,
+                                     const char *pattern, size_t pattern_len,
+                                     Context *ctx);
+
+long flashsearch_find_all(FsPool *pool, const char *data, size_t len,
+                          const char *pattern, size_t pattern_len,
+                          int threads, size_t **out, Context *ctx);
+
+long flashsearch_find_each(FsPool *pool, const char *data, size_t len,
+                           const char *pattern, size_t pattern_len,
+                           int threads, FsHitFn fn, void *arg,
+                           Context *ctx);
+
+long flashsearch_stream_fd(FsPool *pool, int fd,
+                           const char *pattern, size_t pattern_len,
+                           int flags, int threads,
+                           FsHitFn fn, void *arg, Context *ctx);
+
+long flashsearch_stream_file(FsPool *pool, const char *path,
+                             const char *pattern, size_t pattern_len,
+                             int flags, int threads,
+                             FsHitFn fn, void *arg, Context *ctx);
+
+typedef struct FsFile FsFile;
+
+typedef struct {
+    int strategy;
+    int huge;
+    long minor_faults;
+    long major_faults;
+    size_t readahead;
+    size_t resident;
+} FsFileStats;
+
+FsFile *flashsearch_open_file(const char *path, int flags, int threads);
+const char *flashsearch_file_data(const FsFile *f, size_t *len);
+void flashsearch_file_stats(const FsFile *f, FsFileStats *st);
+void flashsearch_close_file(FsFile *f);
+
+typedef struct {
+    long records;
+    long tags;
+    double zipf;
+    int note_max;
+    int note_pct;
+    unsigned long long seed;
+    int nplant;
+    const char *plant[FS_GEN_PLANTS];
+    long plant_rec[FS_GEN_PLANTS];
+    size_t plant_off[FS_GEN_PLANTS];
+    long *tag_count;
+    size_t bytes;
+} FsGen;
+
+void flashsearch_gen_init(FsGen *g, long records);
+int flashsearch_generate(FsGen *g, const char *path, int threads);
+
+typedef struct {
+    size_t frame;
+    size_t offset;
+} FsFrameHit;
+
+long flashsearch_archive_find_all(FsPool *pool, const char *data, size_t len,
+                                  const char *pattern, size_t pattern_len, int flags,
+                                  int threads, FsFrameHit **out, Context *ctx);
+
+typedef struct {
+    int flags;
+    size_t split;
+    int nfilter;
+    const char *filter[FS_TREE_FILTERS];
+    long files;
+    long matched;
+    long skipped;
+    long dirs;
+    size_t bytes;
+} FsTree;
+
+typedef int (*FsPathFn)(const char *path, const size_t *offsets, size_t n, void *arg);
+
+void flashsearch_tree_init(FsTree *tr);
+long flashsearch_tree(FsPool *pool, const char *root,
+                      const char *pattern, size_t pattern_len, FsTree *tr,
+                      int threads, FsPathFn fn, void *arg, Context *ctx);
+
+typedef struct FsDaemon FsDaemon;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t op;
+    uint32_t flags;
+    uint32_t corpus;
+    uint64_t pattern_len;
+    uint64_t max;
+} FsQuery;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t threads;
+    int64_t count;
+    uint64_t nout;
+    uint64_t found;
+    uint64_t position;
+    uint64_t bytes;
+    uint64_t cycles;
+    uint64_t first_match_cycles;
+    FsThreadStats stats;
+} FsReply;
+
+FsDaemon *flashsearch_daemon_create(int threads);
+int flashsearch_daemon_load(FsDaemon *dm, const char *name, const char *path, int flags);
+int flashsearch_daemon_serve(FsDaemon *dm, const char *socket_path);
+void flashsearch_daemon_stop(FsDaemon *dm);
+void flashsearch_daemon_destroy(FsDaemon *dm);
+
+int flashsearch_client_open(const char *socket_path);
+long flashsearch_client_query(int fd, FsQuery *q, const char *pattern,
+                              FsReply *r, uint64_t **offsets);
+
+typedef struct {
+    size_t line;
+    size_t start, end;
+} FsLine;
+
+long flashsearch_lines(FsPool *pool, const char *data, size_t len,
+                       const char *pattern, size_t pattern_len, int flags,
+                       int threads, FsLine **out, Context *ctx);
+
+long flashsearch_count_lines(FsPool *pool, const char *data, size_t len,
+                             const char *pattern, size_t pattern_len, int flags,
+                             int threads, Context *ctx);
+
+typedef struct {
+    const char *pattern;
+    size_t pattern_len;
+    int flags;
+    const char *result;
+} FsJob;
+
+int flashsearch_batch(FsPool *pool, const char *data, size_t len,
+                      FsJob *jobs, int count, int threads, Context *ctx);
+
+typedef struct FsRegex FsRegex;
+
+FsRegex *flashsearch_regex_compile(const char *expr, int flags);
+void flashsearch_regex_free(FsRegex *re);
+
+const char *flashsearch_regex_find(const FsRegex *re, FsPool *pool,
+                                   const char *data, size_t len, int threads,
+                                   size_t *match_len, Context *ctx);
+
+typedef struct FsIndex FsIndex;
+
+int flashsearch_index_build(FsPool *pool, const char *data, size_t len,
+                            const char *path, int threads);
+FsIndex *flashsearch_index_open(const char *path);
+void flashsearch_index_close(FsIndex *ix);
+
+const char *flashsearch_index_find(const FsIndex *ix,
+                                   const char *data, size_t len,
+                                   const char *pattern, size_t pattern_len,
+                                   Context *ctx);
+
+long flashsearch_index_find_all(const FsIndex *ix,
+                                const char *data, size_t len,
+                                const char *pattern, size_t pattern_len,
+                                size_t **out, Context *ctx);
+
+FsMulti *flashsearch_multi_compile(const char *const *patterns,
+                                   const size_t *lens, int count);
+void flashsearch_multi_free(FsMulti *m);
+int flashsearch_multi_kind(const FsMulti *m);
+
+long flashsearch_multi_all(const FsMulti *m, FsPool *pool,
+                           const char *data, size_t len, int threads,
+                           FsMatch **out, Context *ctx);
+
+long flashsearch_multi_each(const FsMulti *m, FsPool *pool,
+                            const char *data, size_t len, int threads,
+                            FsMultiFn fn, void *arg, Context *ctx);
+
+FsPattern *flashsearch_pattern_compile(const char *pattern, size_t pattern_len,
+                                      int flags);
+void flashsearch_pattern_free(FsPattern *pat);
+int flashsearch_pattern_kernel(const FsPattern *pat);
+
+const char *flashsearch_search_compiled(const FsPattern *pat, FsPool *pool,
+                                        const char *data, size_t len,
+                                        int threads, Context *ctx);
+
 double flashsearch_gbps(const Context *ctx, double ms);
 void flashsearch_print(const Context *ctx, double ms, size_t total);
+int flashsearch_stats_json(const Context *ctx, char *buf, size_t n);
 
 #endif
@@ -0,0 +1,628 @@
+#include "flashsearch_internal.h"
+#include <dlfcn.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FS_Z_SPAN (256 * 1024)
+#define FS_LZ4_HIST (64 * 1024)
+#define FS_Z_SLACK 32
+#define FS_LZ4_LEGACY_BLOCK (8 * 1024 * 1024)
+
+#define FS_LZ4_MAGIC 0x184D2204u
+#define FS_LZ4_LEGACY 0x184C2102u
+#define FS_ZSTD_MAGIC 0xFD2FB528u
+#define FS_SKIP_MAGIC 0x184D2A50u
+
+#define Z_LZ4 0
+#define Z_RAW 1
+#define Z_LINKED 2
+#define Z_ZSTD 3
+
+typedef struct {
+    const void *src;
+    size_t size;
+    size_t pos;
+} ZInBuf;
+
+typedef struct {
+    void *dst;
+    size_t size;
+    size_t pos;
+} ZOutBuf;
+
+typedef struct {
+    int ok;
+    void *(*create)(void);
+    size_t (*release)(void *dctx);
+    size_t (*stream)(void *dctx, ZOutBuf *out, ZInBuf *in);
+    size_t (*frame)(const void *src, size_t n);
+    unsigned (*error)(size_t code);
+} ZstdLib;
+
+typedef struct {
+    int kind;
+    int bsum;
+    const uint8_t *src;
+    size_t sn;
+    size_t cap;
+    size_t frame;
+    size_t out;
+    size_t hn, tn;
+    char *edge;
+} ZUnit;
+
+typedef struct {
+    size_t unit;
+    size_t off;
+} ZHit;
+
+typedef struct {
+    ZHit *v;
+    size_t n;
+    size_t cap;
+} ZHits;
+
+typedef struct {
+    ZUnit *us;
+    size_t nu;
+    atomic_size_t *next;
+    const FsNeedle *nd;
+    size_t keep;
+    size_t hist;
+    size_t bufcap;
+    ZHits hits;
+    FsThreadStats stats;
+    int err;
+} __attribute__((aligned(64))) ZWorker;
+
+typedef struct {
+    ZWorker *w;
+    ZUnit *u;
+    size_t ui;
+    char *buf;
+    size_t base;
+    size_t done;
+    size_t seen;
+} ZScan;
+
+ZstdLib fs_zstd;
+pthread_once_t fs_zstd_once = PTHREAD_ONCE_INIT;
+
+void zstd_open(void) {
+    void *h = dlopen("libzstd.so.1", RTLD_NOW | RTLD_LOCAL);
+    if (!h) h = dlopen("libzstd.so", RTLD_NOW | RTLD_LOCAL);
+    if (!h) return;
+    
+    fs_zstd.create = (void*(*)(void))dlsym(h, "ZSTD_createDCtx");
+    fs_zstd.release = (size_t(*)(void*))dlsym(h, "ZSTD_freeDCtx");
+    fs_zstd.stream = (size_t(*)(void*, ZOutBuf*, ZInBuf*))dlsym(h, "ZSTD_decompressStream");
+    fs_zstd.frame = (size_t(*)(const void*, size_t))dlsym(h, "ZSTD_findFrameCompressedSize");
+    fs_zstd.error = (unsigned(*)(size_t))dlsym(h, "ZSTD_isError");
+    
+    fs_zstd.ok = fs_zstd.create && fs_zstd.release && fs_zstd.stream &&
+                 fs_zstd.frame && fs_zstd.error;
+}
+
+int zstd_ready(void) {
+    pthread_once(&fs_zstd_once, zstd_open);
+    return fs_zstd.ok;
+}
+
+uint32_t rd32(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+int zhits_push(ZHits *hs, size_t unit, size_t off) {
+    if (hs->n == hs->cap) {
+        size_t nc = hs->cap ? hs->cap * 2 : 1024;
+        ZHit *nv = realloc(hs->v, nc * sizeof(ZHit));
+        if (!nv) return -1;
+        hs->v = nv;
+        hs->cap = nc;
+    }
+    hs->v[hs->n].unit = unit;
+    hs->v[hs->n].off = off;
+    hs->n++;
+    return 0;
+}
+
+int zscan_to(ZScan *z, size_t end) {
+    ZUnit *u = z->u;
+    size_t keep = z->w->keep;
+    
+    if (u->hn < keep && end > u->hn) {
+        size_t k = (end < keep ? end : keep) - u->hn;
+        memcpy(u->edge + u->hn, z->buf + (u->hn - z->base), k);
+        u->hn += k;
+    }
+    
+    z->w->stats.bytes += end - z->seen;
+    z->seen = end;
+    
+    const FsNeedle *nd = z->w->nd;
+    if (end < nd->nl) return 0;
+    
+    size_t lim = end - nd->nl + 1;
+    size_t i = z->done;
+    
+    while (i < lim) {
+        size_t bs = 0;
+        const char *f = needle_find(z->buf + (i - z->base), end - i, nd, NULL, &bs);
+        if (!f) break;
+        
+        size_t pos = z->base + (f - z->buf);
+        if (zhits_push(&z->w->hits, z->ui, pos) < 0) return -1;
+        i = pos + 1;
+    }
+    
+    if (lim > z->done) z->done = lim;
+    return 0;
+}
+
+int lz4_block(ZScan *z, const uint8_t *ip, size_t sn, char **opp, char *oe) {
+    const uint8_t *ie = ip + sn;
+    char *op = *opp;
+    char *mark = op;
+    
+    while (ip < ie) {
+        unsigned tok = *ip++;
+        
+        size_t ll = tok >> 4;
+        if (ll == 15) {
+            unsigned b;
+            do {
+                if (ip >= ie) return -1;
+                b = *ip++;
+                ll += b;
+            } while (b == 255);
+        }
+        if (ll > (size_t)(ie - ip) || ll > (size_t)(oe - op)) return -1;
+        
+        if ((size_t)(ie - ip) >= ll + 16) {
+            for (size_t k = 0; k < ll; k += 16) memcpy(op + k, ip + k, 16);
+        } else {
+            memcpy(op, ip, ll);
+        }
+        op += ll;
+        ip += ll;
+        if (ip == ie) break;
+        
+        if (ie - ip < 2) return -1;
+        size_t off = ip[0] | ip[1] << 8;
+        ip += 2;
+        if (off == 0 || off > (size_t)(op - z->buf)) return -1;
+        
+        size_t ml = tok & 15;
+        if (ml == 15) {
+            unsigned b;
+            do {
+                if (ip >= ie) return -1;
+                b = *ip++;
+                ml += b;
+            } while (b == 255);
+        }
+        ml += 4;
+        if (ml > (size_t)(oe - op)) return -1;
+        
+        const char *m = op - off;
+        if (off >= 16) {
+            for (size_t k = 0; k < ml; k += 16) memcpy(op + k, m + k, 16);
+        } else if (off >= 8) {
+            size_t k = 0;
+            for (; k + 8 <= ml; k += 8) memcpy(op + k, m + k, 8);
+            for (; k < ml; k++) op[k] = m[k];
+        } else {
+            for (size_t k = 0; k < ml; k++) op[k] = m[k];
+        }
+        op += ml;
+        
+        if (op - mark >= FS_Z_SPAN) {
+            if (zscan_to(z, z->base + (op - z->buf)) < 0) return -1;
+            mark = op;
+        }
+    }
+    
+    *opp = op;
+    return 0;
+}
+
+int run_linked(ZScan *z, char *buf) {
+    ZUnit *u = z->u;
+    size_t hist = z->w->hist;
+    const uint8_t *ip = u->src, *ie = u->src + u->sn;
+    char *op = buf;
+    
+    for (;;) {
+        if (ie - ip < 4) return -1;
+        uint32_t bs = rd32(ip);
+        ip += 4;
+        if (bs == 0) break;
+        
+        size_t n = bs & 0x7FFFFFFFu;
+        if (n > (size_t)(ie - ip)) return -1;
+        
+        if (bs >> 31) {
+            if (n > u->cap) return -1;
+            memcpy(op, ip, n);
+            op += n;
+        } else if (lz4_block(z, ip, n, &op, op + u->cap) < 0) {
+            return -1;
+        }
+        ip += n + (u->bsum ? 4 : 0);
+        
+        if (zscan_to(z, z->base + (op - buf)) < 0) return -1;
+        
+        if ((size_t)(op - buf) > hist) {
+            size_t drop = (op - buf) - hist;
+            memmove(buf, buf + drop, hist);
+            z->base += drop;
+            op -= drop;
+        }
+    }
+    
+    u->out = z->base + (op - buf);
+    return 0;
+}
+
+int run_zstd(ZScan *z, char *buf) {
+    ZUnit *u = z->u;
+    size_t keep = z->w->keep;
+    
+    void *dc = fs_zstd.create();
+    if (!dc) return -1;
+    
+    ZInBuf in = {u->src, u->sn, 0};
+    ZOutBuf out = {buf, z->w->bufcap, 0};
+    int rc = -1;
+    
+    for (;;) {
+        size_t ip = in.pos, op = out.pos;
+        size_t r = fs_zstd.stream(dc, &out, &in);
+        if (fs_zstd.error(r)) break;
+        
+        if (zscan_to(z, z->base + out.pos) < 0) break;
+        
+        if (r == 0) {
+            rc = 0;
+            break;
+        }
+        if (in.pos == ip && out.pos == op) break;
+        
+        if (out.pos > keep && out.size - out.pos < FS_Z_SPAN / 2) {
+            size_t drop = out.pos - keep;
+            memmove(buf, buf + drop, keep);
+            z->base += drop;
+            out.pos = keep;
+        }
+    }
+    
+    u->out = z->base + out.pos;
+    fs_zstd.release(dc);
+    return rc;
+}
+
+int unit_run(ZWorker *w, size_t ui, char *buf) {
+    ZUnit *u = &w->us[ui];
+    ZScan z = {w, u, ui, buf, 0, 0, 0};
+    
+    if (w->keep) {
+        u->edge = malloc(2 * w->keep);
+        if (!u->edge) return -1;
+    }
+    
+    int rc = 0;
+    switch (u->kind) {
+    case Z_RAW:
+        z.buf = (char*)u->src;
+        u->out = u->sn;
+        rc = zscan_to(&z, u->out);
+        break;
+    case Z_LZ4: {
+        char *op = buf;
+        rc = lz4_block(&z, u->src, u->sn, &op, buf + u->cap);
+        u->out = op - buf;
+        if (rc == 0) rc = zscan_to(&z, u->out);
+        break;
+    }
+    case Z_LINKED:
+        rc = run_linked(&z, buf);
+        break;
+    default:
+        rc = run_zstd(&z, buf);
+        break;
+    }
+    if (rc < 0) return -1;
+    
+    u->tn = u->out < w->keep ? u->out : w->keep;
+    if (u->tn) memcpy(u->edge + w->keep, z.buf + (u->out - u->tn - z.base), u->tn);
+    return 0;
+}
+
+void *worker_archive(void *arg) {
+    ZWorker *w = (ZWorker*)arg;
+    unsigned long long c0 = fs_tl_cand, m0 = fs_tl_miss;
+    
+    char *buf = w->bufcap ? malloc(w->bufcap + FS_Z_SLACK) : NULL;
+    if (w->bufcap && !buf) {
+        w->err = 1;
+        return NULL;
+    }
+    
+    for (;;) {
+        size_t ui = atomic_fetch_add(w->next, 1);
+        if (ui >= w->nu) break;
+        
+        if (unit_run(w, ui, buf) < 0) w->err = 1;
+        w->stats.chunks++;
+    }
+    
+    w->stats.candidates = fs_tl_cand - c0;
+    w->stats.false_positives = fs_tl_miss - m0;
+    
+    free(buf);
+    return NULL;
+}
+
+int plan_add(ZUnit **us, size_t *n, size_t *cap, int kind, const uint8_t *src,
+             size_t sn, size_t ucap, size_t frame) {
+    if (*n == *cap) {
+        size_t nc = *cap ? *cap * 2 : 256;
+        ZUnit *nv = realloc(*us, nc * sizeof(ZUnit));
+        if (!nv) return -1;
+        *us = nv;
+        *cap = nc;
+    }
+    
+    ZUnit *u = &(*us)[(*n)++];
+    memset(u, 0, sizeof(*u));
+    u->kind = kind;
+    u->src = src;
+    u->sn = sn;
+    u->cap = ucap;
+    u->frame = frame;
+    return 0;
+}
+
+long lz4_frame(const uint8_t *d, size_t l, size_t at, size_t frame,
+               ZUnit **us, size_t *n, size_t *cap) {
+    size_t h = at + 4;
+    if (l - h < 3) return -1;
+    
+    uint8_t flg = d[h], bd = d[h + 1];
+    int bid = bd >> 4 & 7;
+    if (flg >> 6 != 1 || (flg & 1) || bid < 4) return -1;
+    
+    int indep = flg >> 5 & 1;
+    int bsum = flg >> 4 & 1;
+    size_t bmax = (size_t)1 << (2 * bid + 8);
+    
+    h += 3 + ((flg >> 3 & 1) ? 8 : 0);
+    if (h > l) return -1;
+    
+    size_t fb = h;
+    
+    for (;;) {
+        if (l - h < 4) return -1;
+        uint32_t bs = rd32(d + h);
+        h += 4;
+        if (bs == 0) break;
+        
+        size_t bn = bs & 0x7FFFFFFFu;
+        if (bn > bmax || bn > l - h) return -1;
+        
+        if (indep && plan_add(us, n, cap, bs >> 31 ? Z_RAW : Z_LZ4,
+                              d + h, bn, bs >> 31 ? 0 : bmax, frame) < 0) return -1;
+        
+        h += bn + (bsum ? 4 : 0);
+        if (h > l) return -1;
+    }
+    
+    if (!indep) {
+        if (plan_add(us, n, cap, Z_LINKED, d + fb, h - fb, bmax, frame) < 0) return -1;
+        (*us)[*n - 1].bsum = bsum;
+    }
+    
+    h += (flg >> 2 & 1) ? 4 : 0;
+    return h > l ? -1 : (long)h;
+}
+
+int archive_plan(const uint8_t *d, size_t l, ZUnit **us, size_t *n) {
+    size_t cap = 0, at = 0, frame = 0;
+    *us = NULL;
+    *n = 0;
+    
+    while (at < l) {
+        if (l - at < 4) return -1;
+        uint32_t mg = rd32(d + at);
+        
+        if ((mg & 0xFFFFFFF0u) == FS_SKIP_MAGIC) {
+            if (l - at < 8 || rd32(d + at + 4) > l - at - 8) return -1;
+            at += 8 + rd32(d + at + 4);
+        } else if (mg == FS_LZ4_MAGIC) {
+            long e = lz4_frame(d, l, at, frame++, us, n, &cap);
+            if (e < 0) return -1;
+            at = e;
+        } else if (mg == FS_LZ4_LEGACY) {
+            at += 4;
+            while (l - at >= 4) {
+                uint32_t cs = rd32(d + at);
+                if (cs == FS_LZ4_MAGIC || cs == FS_LZ4_LEGACY || cs == FS_ZSTD_MAGIC ||
+                    (cs & 0xFFFFFFF0u) == FS_SKIP_MAGIC) break;
+                if (cs > l - at - 4) return -1;
+                if (plan_add(us, n, &cap, Z_LZ4, d + at + 4, cs, FS_LZ4_LEGACY_BLOCK, frame) < 0) return -1;
+                at += 4 + cs;
+            }
+            frame++;
+        } else if (mg == FS_ZSTD_MAGIC) {
+            if (!zstd_ready()) return -1;
+            size_t fl = fs_zstd.frame(d + at, l - at);
+            if (fs_zstd.error(fl) || fl > l - at) return -1;
+            if (plan_add(us, n, &cap, Z_ZSTD, d + at, fl, 0, frame++) < 0) return -1;
+            at += fl;
+        } else {
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+int zhit_cmp(const void *a, const void *b) {
+    const ZHit *x = a, *y = b;
+    if (x->unit != y->unit) return x->unit < y->unit ? -1 : 1;
+    return x->off < y->off ? -1 : x->off > y->off;
+}
+
+int archive_seams(ZUnit *us, size_t nu, const FsNeedle *nd, size_t keep, ZHits *hs) {
+    if (!keep) return 0;
+    
+    char *sb = malloc(2 * keep);
+    if (!sb) return -1;
+    
+    for (size_t k = 0; k < nu; k++) {
+        ZUnit *u = &us[k];
+        if (!u->tn) continue;
+        
+        memcpy(sb, u->edge + keep, u->tn);
+        size_t sl = u->tn;
+        
+        for (size_t m = k + 1; m < nu && sl < u->tn + keep; m++) {
+            size_t c = us[m].hn < u->tn + keep - sl ? us[m].hn : u->tn + keep - sl;
+            memcpy(sb + sl, us[m].edge, c);
+            sl += c;
+            if (us[m].hn < us[m].out) break;
+        }
+        
+        size_t i = 0;
+        while (i < u->tn && i + nd->nl <= sl) {
+            size_t bs = 0;
+            const char *f = needle_find(sb + i, sl - i, nd, NULL, &bs);
+            if (!f || (size_t)(f - sb) >= u->tn) break;
+            
+            size_t j = f - sb;
+            if (zhits_push(hs, k, u->out - u->tn + j) < 0) {
+                free(sb);
+                return -1;
+            }
+            i = j + 1;
+        }
+    }
+    
+    free(sb);
+    return 0;
+}
+
+long flashsearch_archive_find_all(FsPool *pool, const char *d, size_t l,
+                                  const char *p, size_t pl, int flags, int t,
+                                  FsFrameHit **out, Context *ctx) {
+    if (out) *out = NULL;
+    if (!out || !d || !p) return -1;
+    
+    t = find_threads(pool, t);
+    ctx_begin(ctx);
+    
+    if (pl == 0) {
+        ctx_end(ctx, d, NULL);
+        return 0;
+    }
+    
+    ZUnit *us;
+    size_t nu;
+    if (archive_plan((const uint8_t*)d, l, &us, &nu) < 0) {
+        free(us);
+        ctx_end(ctx, d, NULL);
+        return -1;
+    }
+    
+    FsNeedle nd;
+    needle_init(&nd, p, pl, flags);
+    
+    size_t keep = pl - 1;
+    size_t hist = keep > FS_LZ4_HIST ? keep : FS_LZ4_HIST;
+    size_t bc = 0;
+    
+    for (size_t k = 0; k < nu; k++) {
+        size_t need = us[k].kind == Z_LZ4 ? us[k].cap :
+                      us[k].kind == Z_LINKED ? hist + us[k].cap :
+                      us[k].kind == Z_ZSTD ? keep + FS_Z_SPAN : 0;
+        if (need > bc) bc = need;
+    }
+    
+    atomic_size_t next = 0;
+    ZWorker ws[MAX_THREADS];
+    memset(ws, 0, sizeof(ws));
+    
+    if ((size_t)t > nu) t = nu ? (int)nu : 1;
+    
+    for (int i = 0; i < t; i++) {
+        ws[i].us = us;
+        ws[i].nu = nu;
+        ws[i].next = &next;
+        ws[i].nd = &nd;
+        ws[i].keep = keep;
+        ws[i].hist = hist;
+        ws[i].bufcap = bc;
+    }
+    
+    run_workers(pool, t, worker_archive, ws, sizeof(ZWorker), NULL);
+    
+    long r = 0;
+    ZHits all = {0};
+    
+    for (int i = 0; i < t; i++) {
+        stats_add(ctx, i, &ws[i].stats);
+        if (ws[i].err) r = -1;
+        
+        for (size_t k = 0; r == 0 && k < ws[i].hits.n; k++) {
+            if (zhits_push(&all, ws[i].hits.v[k].unit, ws[i].hits.v[k].off) < 0) r = -1;
+        }
+        free(ws[i].hits.v);
+    }
+    
+    if (r == 0) r = archive_seams(us, nu, &nd, keep, &all);
+    
+    if (r == 0) {
+        if (all.n > 1) qsort(all.v, all.n, sizeof(ZHit), zhit_cmp);
+        
+        FsFrameHit *v = malloc((all.n ? all.n : 1) * sizeof(FsFrameHit));
+        size_t *fo = malloc((nu ? nu : 1) * sizeof(size_t));
+        
+        if (v && fo) {
+            size_t at = 0, abs = 0, first = 0;
+            for (size_t k = 0; k < nu; k++) {
+                if (k && us[k].frame != us[k - 1].frame) at = 0;
+                fo[k] = at;
+                at += us[k].out;
+            }
+            
+            for (size_t k = 0; k < all.n; k++) {
+                v[k].frame = us[all.v[k].unit].frame;
+                v[k].offset = fo[all.v[k].unit] + all.v[k].off;
+            }
+            
+            if (all.n) {
+                for (size_t k = 0; k < all.v[0].unit; k++) abs += us[k].out;
+                first = abs + all.v[0].off;
+            }
+            
+            *out = v;
+            r = (long)all.n;
+            
+            if (ctx && all.n) {
+                atomic_store(&ctx->found, true);
+                atomic_store(&ctx->position, first);
+            }
+        } else {
+            free(v);
+            r = -1;
+        }
+        free(fo);
+    }
+    
+    free(all.v);
+    for (size_t k = 0; k < nu; k++) free(us[k].edge);
+    free(us);
+    
+    ctx_end(ctx, d, NULL);
+    return r;
+}
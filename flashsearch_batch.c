@@ -0,0 +1,131 @@
+#include "flashsearch_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    const char *data;
+    size_t len;
+    size_t start, end;
+    const FsNeedle *nds;
+    int n;
+    atomic_size_t *best;
+    int *act;
+    FsThreadStats stats;
+} __attribute__((aligned(64))) BatchWorker;
+
+void *worker_batch(void *arg) {
+    BatchWorker *w = (BatchWorker*)arg;
+    int na = 0;
+    
+    for (int j = 0; j < w->n; j++) {
+        if (w->nds[j].nl > 0 && w->nds[j].nl <= w->len) w->act[na++] = j;
+    }
+    
+    unsigned long long c0 = fs_tl_cand, m0 = fs_tl_miss;
+    memset(&w->stats, 0, sizeof(w->stats));
+    
+    for (size_t bs = w->start; bs < w->end && na > 0; bs += FS_BATCH_BLOCK) {
+        size_t be = bs + FS_BATCH_BLOCK < w->end ? bs + FS_BATCH_BLOCK : w->end;
+        int k = 0;
+        
+        for (int a = 0; a < na; a++) {
+            int j = w->act[a];
+            const FsNeedle *nd = &w->nds[j];
+            
+            size_t b = atomic_load(&w->best[j]);
+            if (b <= bs) continue;
+            
+            size_t se = w->len - be > nd->nl - 1 ? be + nd->nl - 1 : w->len;
+            size_t sc = 0;
+            const char *f = bs + nd->nl <= se ?
+                            needle_find(w->data + bs, se - bs, nd, NULL, &sc) : NULL;
+            
+            if (f) {
+                size_t pos = f - w->data;
+                while (pos < b && !atomic_compare_exchange_weak(&w->best[j], &b, pos));
+                continue;
+            }
+            
+            w->act[k++] = j;
+        }
+        
+        na = k;
+        w->stats.bytes += be - bs;
+        w->stats.chunks++;
+    }
+    
+    w->stats.candidates = fs_tl_cand - c0;
+    w->stats.false_positives = fs_tl_miss - m0;
+    return NULL;
+}
+
+int flashsearch_batch(FsPool *pool, const char *d, size_t l,
+                      FsJob *jobs, int n, int t, Context *ctx) {
+    if (!d || !jobs || n < 0) return -1;
+    
+    t = find_threads(pool, t);
+    ctx_begin(ctx);
+    
+    for (int j = 0; j < n; j++) jobs[j].result = NULL;
+    if (n == 0) {
+        ctx_end(ctx, d, NULL);
+        return 0;
+    }
+    
+    FsNeedle *nds = aligned_alloc(64, n * sizeof(FsNeedle));
+    atomic_size_t *best = malloc(n * sizeof(atomic_size_t));
+    int *act = malloc((size_t)t * n * sizeof(int));
+    if (!nds || !best || !act) {
+        free(nds);
+        free(best);
+        free(act);
+        ctx_end(ctx, d, NULL);
+        return -1;
+    }
+    
+    for (int j = 0; j < n; j++) {
+        nds[j].nl = 0;
+        if (jobs[j].pattern && jobs[j].pattern_len > 0) {
+            needle_init(&nds[j], jobs[j].pattern, jobs[j].pattern_len, jobs[j].flags);
+        }
+        atomic_store(&best[j], SIZE_MAX);
+    }
+    
+    BatchWorker ws[MAX_THREADS];
+    size_t ch = l / t;
+    
+    for (int i = 0; i < t; i++) {
+        ws[i].data = d;
+        ws[i].len = l;
+        ws[i].start = i * ch;
+        ws[i].end = (i == t - 1) ? l : (i + 1) * ch;
+        ws[i].nds = nds;
+        ws[i].n = n;
+        ws[i].best = best;
+        ws[i].act = act + (size_t)i * n;
+    }
+    
+    run_workers(pool, t, worker_batch, ws, sizeof(BatchWorker), NULL);
+    
+    int found = 0;
+    const char *first = NULL;
+    
+    for (int j = 0; j < n; j++) {
+        size_t b = atomic_load(&best[j]);
+        if (b == SIZE_MAX) continue;
+        jobs[j].result = d + b;
+        if (!first || jobs[j].result < first) first = jobs[j].result;
+        found++;
+    }
+    
+    for (int i = 0; i < t; i++) {
+        stats_add(ctx, i, &ws[i].stats);
+    }
+    
+    free(nds);
+    free(best);
+    free(act);
+    
+    ctx_end(ctx, d, first);
+    return found;
+}
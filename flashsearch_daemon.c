@@ -0,0 +1,433 @@
+#include "flashsearch_internal.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define FS_D_MAGIC 0x46534451u
+#define FS_D_CLIENTS 64
+#define FS_D_MAX_PATTERN (1024 * 1024)
+
+typedef struct {
+    char name[64];
+    FsFile *file;
+    const char *data;
+    size_t len;
+} Corpus;
+
+struct FsDaemon {
+    FsPool *pool;
+    int threads;
+    Corpus cs[FS_D_CORPORA];
+    int nc;
+    int lfd;
+    int wake[2];
+    atomic_bool quit;
+    char *pat;
+    uint64_t *offs;
+    size_t offcap;
+};
+
+typedef struct {
+    int fd;
+    char *in;
+    size_t inn, incap;
+    char *out;
+    size_t outn, outat, outcap;
+} Client;
+
+int client_grow(char **b, size_t *cap, size_t n) {
+    if (n <= *cap) return 0;
+    size_t nc = *cap ? *cap : 4096;
+    while (nc < n) nc *= 2;
+    char *nb = realloc(*b, nc);
+    if (!nb) return -1;
+    *b = nb;
+    *cap = nc;
+    return 0;
+}
+
+int io_full(int fd, void *p, size_t n, int wr) {
+    char *b = p;
+    while (n) {
+        ssize_t r = wr ? send(fd, b, n, MSG_NOSIGNAL) : recv(fd, b, n, 0);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        b += r;
+        n -= r;
+    }
+    return 0;
+}
+
+int sock_addr(struct sockaddr_un *a, const char *path) {
+    memset(a, 0, sizeof(*a));
+    a->sun_family = AF_UNIX;
+    if (!path || strlen(path) >= sizeof(a->sun_path)) return -1;
+    strcpy(a->sun_path, path);
+    return 0;
+}
+
+FsDaemon *flashsearch_daemon_create(int threads) {
+    FsDaemon *dm = calloc(1, sizeof(FsDaemon));
+    if (!dm) return NULL;
+    
+    dm->lfd = -1;
+    dm->wake[0] = dm->wake[1] = -1;
+    dm->pool = flashsearch_pool_create(threads > 0 ? threads : MAX_THREADS);
+    dm->pat = malloc(FS_D_MAX_PATTERN);
+    
+    if (!dm->pool || !dm->pat || pipe(dm->wake) != 0) {
+        flashsearch_daemon_destroy(dm);
+        return NULL;
+    }
+    
+    dm->threads = flashsearch_pool_threads(dm->pool);
+    return dm;
+}
+
+int flashsearch_daemon_load(FsDaemon *dm, const char *name, const char *path, int flags) {
+    if (!dm || !name || !path || dm->nc == FS_D_CORPORA) return -1;
+    if (strlen(name) >= sizeof(dm->cs[0].name)) return -1;
+    
+    FsFile *f = flashsearch_open_file(path, flags | FS_OPEN_POPULATE, dm->threads);
+    if (!f) return -1;
+    
+    Corpus *c = &dm->cs[dm->nc];
+    strcpy(c->name, name);
+    c->file = f;
+    c->data = flashsearch_file_data(f, &c->len);
+    flashsearch_numa_place(c->data, c->len);
+    
+    return dm->nc++;
+}
+
+long daemon_all(FsDaemon *dm, const Corpus *c, const FsQuery *q, size_t *nout, Context *ctx) {
+    size_t pl = q->pattern_len;
+    int t = dm->threads;
+    
+    *nout = 0;
+    ctx_begin(ctx);
+    
+    if (pl == 0 || pl > c->len) {
+        ctx_end(ctx, c->data, NULL);
+        return 0;
+    }
+    
+    FsNeedle nd;
+    needle_init(&nd, dm->pat, pl, q->flags);
+    
+    Collector cs[MAX_THREADS];
+    memset(cs, 0, sizeof(cs));
+    
+    long r = -1;
+    if (collect_range(dm->pool, t, cs, c->data, c->len, 0, c->len, &nd, ctx) == 0) {
+        size_t tot = 0;
+        for (int i = 0; i < t; i++) tot += cs[i].hits.n;
+        
+        size_t want = q->max && q->max < tot ? q->max : tot;
+        if (want > dm->offcap) {
+            uint64_t *nv = realloc(dm->offs, want * sizeof(uint64_t));
+            if (nv) {
+                dm->offs = nv;
+                dm->offcap = want;
+            }
+        }
+        if (want > dm->offcap) want = dm->offcap;
+        
+        for (int i = 0; i < t && *nout < want; i++) {
+            for (size_t j = 0; j < cs[i].hits.n && *nout < want; j++) {
+                dm->offs[(*nout)++] = cs[i].hits.v[j];
+            }
+        }
+        
+        r = (long)tot;
+        const char *first = NULL;
+        for (int i = 0; i < t && !first; i++) {
+            if (cs[i].hits.n) first = c->data + cs[i].hits.v[0];
+        }
+        ctx_end(ctx, c->data, first);
+    } else {
+        ctx_end(ctx, c->data, NULL);
+    }
+    
+    for (int i = 0; i < t; i++) free(cs[i].hits.v);
+    return r;
+}
+
+long daemon_query(FsDaemon *dm, const FsQuery *q, size_t *nout, Context *ctx) {
+    *nout = 0;
+    
+    if (q->op == FS_Q_LOOKUP) {
+        for (int i = 0; i < dm->nc; i++) {
+            if (strlen(dm->cs[i].name) == q->pattern_len &&
+                memcmp(dm->cs[i].name, dm->pat, q->pattern_len) == 0) return i;
+        }
+        return -1;
+    }
+    
+    if (q->corpus >= (uint32_t)dm->nc) return -1;
+    const Corpus *c = &dm->cs[q->corpus];
+    size_t pl = q->pattern_len;
+    
+    switch (q->op) {
+    case FS_Q_FIRST: {
+        ctx_begin(ctx);
+        if (pl == 0 || pl > c->len) {
+            ctx_end(ctx, c->data, NULL);
+            return 0;
+        }
+        
+        FsNeedle nd;
+        needle_init(&nd, dm->pat, pl, q->flags);
+        const char *r = search_needle(dm->pool, c->data, c->len, &nd, dm->threads,
+                                      NULL, NULL, 0, ctx);
+        if (!r) return 0;
+        
+        if (dm->offcap < 1) {
+            uint64_t *nv = realloc(dm->offs, sizeof(uint64_t));
+            if (!nv) return 1;
+            dm->offs = nv;
+            dm->offcap = 1;
+        }
+        dm->offs[0] = r - c->data;
+        *nout = 1;
+        return 1;
+    }
+    case FS_Q_ALL:
+        return daemon_all(dm, c, q, nout, ctx);
+    case FS_Q_LINES:
+        return flashsearch_count_lines(dm->pool, c->data, c->len, dm->pat, pl,
+                                       q->flags, dm->threads, ctx);
+    default:
+        return -1;
+    }
+}
+
+int daemon_answer(FsDaemon *dm, Client *c) {
+    FsQuery q;
+    memcpy(&q, c->in, sizeof(q));
+    memcpy(dm->pat, c->in + sizeof(q), q.pattern_len);
+    c->inn = 0;
+    
+    Context ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    size_t nout = 0;
+    
+    FsReply r;
+    memset(&r, 0, sizeof(r));
+    r.magic = FS_D_MAGIC;
+    r.count = daemon_query(dm, &q, &nout, &ctx);
+    r.nout = nout;
+    
+    if (q.op != FS_Q_LOOKUP) {
+        r.found = atomic_load(&ctx.found);
+        r.position = atomic_load(&ctx.position);
+        r.bytes = atomic_load(&ctx.bytes_scanned);
+        r.cycles = atomic_load(&ctx.cycles_end) - atomic_load(&ctx.cycles_start);
+        r.first_match_cycles = ctx.stats.first_match_cycles;
+        r.threads = ctx.stats.threads;
+        r.stats = ctx.stats.sum;
+    }
+    
+    size_t n = sizeof(r) + nout * sizeof(uint64_t);
+    if (client_grow(&c->out, &c->outcap, n) < 0) return -1;
+    
+    memcpy(c->out, &r, sizeof(r));
+    if (nout) memcpy(c->out + sizeof(r), dm->offs, nout * sizeof(uint64_t));
+    c->outn = n;
+    c->outat = 0;
+    return 0;
+}
+
+int client_read(FsDaemon *dm, Client *c) {
+    for (;;) {
+        size_t want = sizeof(FsQuery);
+        if (c->inn >= want) {
+            FsQuery q;
+            memcpy(&q, c->in, sizeof(q));
+            if (q.magic != FS_D_MAGIC || q.pattern_len > FS_D_MAX_PATTERN) return -1;
+            want += q.pattern_len;
+            if (c->inn == want) return daemon_answer(dm, c) < 0 ? -1 : 1;
+        }
+        
+        if (client_grow(&c->in, &c->incap, want) < 0) return -1;
+        
+        ssize_t r = recv(c->fd, c->in + c->inn, want - c->inn, MSG_DONTWAIT);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        if (r <= 0) return -1;
+        c->inn += r;
+    }
+}
+
+int client_write(Client *c) {
+    while (c->outat < c->outn) {
+        ssize_t r = send(c->fd, c->out + c->outat, c->outn - c->outat,
+                         MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        if (r <= 0) return -1;
+        c->outat += r;
+    }
+    c->outn = c->outat = 0;
+    return 1;
+}
+
+int client_step(FsDaemon *dm, Client *c) {
+    for (;;) {
+        int r = client_write(c);
+        if (r <= 0) return r;
+        
+        r = client_read(dm, c);
+        if (r <= 0) return r;
+    }
+}
+
+void client_close(Client *c) {
+    close(c->fd);
+    free(c->in);
+    free(c->out);
+    memset(c, 0, sizeof(*c));
+}
+
+int daemon_bind(FsDaemon *dm, const char *path) {
+    struct sockaddr_un a;
+    if (sock_addr(&a, path) < 0) return -1;
+    
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    
+    if (connect(fd, (struct sockaddr*)&a, sizeof(a)) == 0) {
+        close(fd);
+        return -1;
+    }
+    if (errno == ECONNREFUSED) unlink(path);
+    close(fd);
+    
+    dm->lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (dm->lfd < 0) return -1;
+    if (bind(dm->lfd, (struct sockaddr*)&a, sizeof(a)) != 0 || listen(dm->lfd, 16) != 0) {
+        close(dm->lfd);
+        dm->lfd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+int flashsearch_daemon_serve(FsDaemon *dm, const char *path) {
+    if (!dm || daemon_bind(dm, path) < 0) return -1;
+    
+    struct pollfd ps[FS_D_CLIENTS + 2];
+    Client cl[FS_D_CLIENTS];
+    memset(cl, 0, sizeof(cl));
+    
+    int np = 2;
+    ps[0].fd = dm->wake[0];
+    ps[0].events = POLLIN;
+    ps[1].fd = dm->lfd;
+    ps[1].events = POLLIN;
+    
+    while (!atomic_load(&dm->quit)) {
+        if (poll(ps, np, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (ps[0].revents) break;
+        
+        if (ps[1].revents & POLLIN) {
+            int cfd = accept4(dm->lfd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+            if (cfd >= 0 && np < FS_D_CLIENTS + 2) {
+                cl[np - 2].fd = cfd;
+                ps[np].fd = cfd;
+                ps[np].events = POLLIN;
+                ps[np].revents = 0;
+                np++;
+            } else if (cfd >= 0) {
+                close(cfd);
+            }
+        }
+        
+        for (int i = 2; i < np; i++) {
+            if (!ps[i].revents) continue;
+            
+            Client *c = &cl[i - 2];
+            if ((ps[i].revents & POLLNVAL) || client_step(dm, c) < 0) {
+                client_close(c);
+                np--;
+                ps[i] = ps[np];
+                cl[i - 2] = cl[np - 2];
+                i--;
+                continue;
+            }
+            ps[i].events = c->outn ? POLLOUT : POLLIN;
+        }
+    }
+    
+    for (int i = 2; i < np; i++) client_close(&cl[i - 2]);
+    close(dm->lfd);
+    dm->lfd = -1;
+    unlink(path);
+    return 0;
+}
+
+void flashsearch_daemon_stop(FsDaemon *dm) {
+    if (!dm) return;
+    atomic_store(&dm->quit, true);
+    if (dm->wake[1] >= 0) {
+        char c = 0;
+        ssize_t r = write(dm->wake[1], &c, 1);
+        (void)r;
+    }
+}
+
+void flashsearch_daemon_destroy(FsDaemon *dm) {
+    if (!dm) return;
+    
+    for (int i = 0; i < dm->nc; i++) flashsearch_close_file(dm->cs[i].file);
+    flashsearch_pool_destroy(dm->pool);
+    if (dm->wake[0] >= 0) close(dm->wake[0]);
+    if (dm->wake[1] >= 0) close(dm->wake[1]);
+    free(dm->pat);
+    free(dm->offs);
+    free(dm);
+}
+
+int flashsearch_client_open(const char *path) {
+    struct sockaddr_un a;
+    if (sock_addr(&a, path) < 0) return -1;
+    
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    
+    if (connect(fd, (struct sockaddr*)&a, sizeof(a)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+long flashsearch_client_query(int fd, FsQuery *q, const char *p,
+                              FsReply *r, uint64_t **offsets) {
+    if (offsets) *offsets = NULL;
+    if (fd < 0 || !q || !r) return -1;
+    
+    q->magic = FS_D_MAGIC;
+    if (io_full(fd, q, sizeof(*q), 1) < 0) return -1;
+    if (q->pattern_len && io_full(fd, (void*)p, q->pattern_len, 1) < 0) return -1;
+    if (io_full(fd, r, sizeof(*r), 0) < 0 || r->magic != FS_D_MAGIC) return -1;
+    
+    if (r->nout) {
+        uint64_t *v = malloc(r->nout * sizeof(uint64_t));
+        if (!v || io_full(fd, v, r->nout * sizeof(uint64_t), 0) < 0) {
+            free(v);
+            return -1;
+        }
+        if (offsets) *offsets = v;
+        else free(v);
+    }
+    
+    return r->count;
+}
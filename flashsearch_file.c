@@ -0,0 +1,309 @@
+#include "flashsearch_internal.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#define FS_HUGE_PAGE (2 * 1024 * 1024)
+#define FS_DIRECT_BLOCK (8 * 1024 * 1024)
+#define FS_DIRECT_ALIGN 4096
+#define FS_MAX_FILES 16
+
+struct FsFile {
+    const char *data;
+    size_t len;
+    void *map;
+    size_t map_len;
+    int strategy;
+    int huge;
+    int populated;
+    long minflt, majflt;
+    atomic_size_t ahead;
+};
+
+typedef struct {
+    int fd;
+    int dfd;
+    char *buf;
+    size_t len;
+    size_t b0, b1;
+    int err;
+} __attribute__((aligned(64))) DirectJob;
+
+// Lazily mapped files searchers may ask read-ahead for. Only the first
+// FS_MAX_FILES open at once are tracked; the rest get plain kernel
+// readahead. fs_readers counts file_ahead calls in flight so close can
+// wait them out before unmapping.
+_Atomic(FsFile*) fs_files[FS_MAX_FILES];
+atomic_int fs_nfiles;
+atomic_int fs_readers;
+
+void file_register(FsFile *f) {
+    for (int i = 0; i < FS_MAX_FILES; i++) {
+        FsFile *e = NULL;
+        if (atomic_compare_exchange_strong(&fs_files[i], &e, f)) {
+            atomic_fetch_add(&fs_nfiles, 1);
+            return;
+        }
+    }
+}
+
+void file_unregister(FsFile *f) {
+    for (int i = 0; i < FS_MAX_FILES; i++) {
+        FsFile *e = f;
+        if (atomic_compare_exchange_strong(&fs_files[i], &e, NULL)) {
+            atomic_fetch_sub(&fs_nfiles, 1);
+            while (atomic_load(&fs_readers)) sched_yield();
+            return;
+        }
+    }
+}
+
+void file_ahead(const char *p, size_t n) {
+    if (!atomic_load_explicit(&fs_nfiles, memory_order_relaxed)) return;
+    
+    atomic_fetch_add(&fs_readers, 1);
+    for (int i = 0; i < FS_MAX_FILES; i++) {
+        FsFile *f = atomic_load(&fs_files[i]);
+        if (!f || p < f->data || p >= f->data + f->len) continue;
+        
+        size_t off = p - f->data;
+        if (n > f->len - off) n = f->len - off;
+        
+        uintptr_t a = (uintptr_t)p & ~(uintptr_t)(FS_DIRECT_ALIGN - 1);
+        if (madvise((void*)a, (uintptr_t)p + n - a, MADV_WILLNEED) == 0) {
+            atomic_fetch_add(&f->ahead, n);
+        }
+        break;
+    }
+    atomic_fetch_sub(&fs_readers, 1);
+}
+
+void file_faults(long *mn, long *mj) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    *mn = ru.ru_minflt;
+    *mj = ru.ru_majflt;
+}
+
+void *huge_alloc(size_t len, size_t *sz, int *huge) {
+    size_t hl = (len + FS_HUGE_PAGE - 1) & ~(size_t)(FS_HUGE_PAGE - 1);
+    if (hl == 0) hl = FS_HUGE_PAGE;
+    
+    void *p = mmap(NULL, hl, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+        *sz = hl;
+        *huge = FS_HUGE_TLB;
+        return p;
+    }
+    
+    size_t rl = hl + FS_HUGE_PAGE;
+    char *r = mmap(NULL, rl, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (r == MAP_FAILED) return NULL;
+    
+    char *a = (char*)(((uintptr_t)r + FS_HUGE_PAGE - 1) & ~(uintptr_t)(FS_HUGE_PAGE - 1));
+    if (a > r) munmap(r, a - r);
+    if (r + rl > a + hl) munmap(a + hl, r + rl - (a + hl));
+    
+    *sz = hl;
+    *huge = madvise(a, hl, MADV_HUGEPAGE) == 0 ? FS_HUGE_THP : FS_HUGE_NONE;
+    return a;
+}
+
+void *direct_worker(void *arg) {
+    DirectJob *j = (DirectJob*)arg;
+    
+    for (size_t o = j->b0; o < j->b1 && !j->err; o += FS_DIRECT_BLOCK) {
+        size_t e = o + FS_DIRECT_BLOCK < j->b1 ? o + FS_DIRECT_BLOCK : j->b1;
+        size_t at = o;
+        int fd = j->dfd >= 0 ? j->dfd : j->fd;
+        
+        while (at < e) {
+            size_t want = e - at;
+            if (fd == j->dfd) want = (want + FS_DIRECT_ALIGN - 1) & ~(size_t)(FS_DIRECT_ALIGN - 1);
+            
+            ssize_t r = pread(fd, j->buf + at, want, at);
+            if (r < 0 && errno == EINTR) continue;
+            if (r < 0 && fd == j->dfd) {
+                fd = j->fd;
+                continue;
+            }
+            if (r <= 0) {
+                j->err = 1;
+                break;
+            }
+            at += r;
+            
+            if (fd == j->dfd && (at & (FS_DIRECT_ALIGN - 1)) && at < e) fd = j->fd;
+        }
+    }
+    
+    return NULL;
+}
+
+int file_read(FsFile *f, int fd, int at, const char *path, int t) {
+    size_t sz;
+    int huge;
+    
+    size_t need = (f->len + FS_DIRECT_ALIGN - 1) & ~(size_t)(FS_DIRECT_ALIGN - 1);
+    char *buf = huge_alloc(need, &sz, &huge);
+    if (!buf) return -1;
+    
+    int dfd = openat(at, path, O_RDONLY | O_DIRECT | O_CLOEXEC);
+    
+    t = find_threads(NULL, t);
+    size_t nb = (f->len + FS_DIRECT_BLOCK - 1) / FS_DIRECT_BLOCK;
+    
+    DirectJob js[MAX_THREADS];
+    for (int i = 0; i < t; i++) {
+        js[i].fd = fd;
+        js[i].dfd = dfd;
+        js[i].buf = buf;
+        js[i].len = f->len;
+        js[i].b0 = nb * i / t * FS_DIRECT_BLOCK;
+        js[i].b1 = nb * (i + 1) / t * FS_DIRECT_BLOCK;
+        if (js[i].b0 > f->len) js[i].b0 = f->len;
+        if (js[i].b1 > f->len) js[i].b1 = f->len;
+        js[i].err = 0;
+    }
+    
+    run_workers(NULL, t, direct_worker, js, sizeof(DirectJob), NULL);
+    if (dfd >= 0) close(dfd);
+    
+    for (int i = 0; i < t; i++) {
+        if (js[i].err) {
+            munmap(buf, sz);
+            return -1;
+        }
+    }
+    
+    mprotect(buf, sz, PROT_READ);
+    
+    f->map = buf;
+    f->map_len = sz;
+    f->data = buf;
+    f->huge = huge;
+    f->populated = 1;
+    f->strategy = dfd >= 0 ? FS_FILE_DIRECT : FS_FILE_READ;
+    return 0;
+}
+
+int file_map(FsFile *f, int fd, int flags) {
+    size_t rl = f->len + FS_HUGE_PAGE;
+    char *r = mmap(NULL, rl, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (r == MAP_FAILED) return -1;
+    
+    char *a = (char*)(((uintptr_t)r + FS_HUGE_PAGE - 1) & ~(uintptr_t)(FS_HUGE_PAGE - 1));
+    int mf = MAP_PRIVATE | MAP_FIXED | ((flags & FS_OPEN_POPULATE) ? MAP_POPULATE : 0);
+    
+    void *m = mmap(a, f->len, PROT_READ, mf, fd, 0);
+    if (m == MAP_FAILED) {
+        munmap(r, rl);
+        return -1;
+    }
+    
+    if (a > r) munmap(r, a - r);
+    size_t ml = (f->len + 4095) & ~(size_t)4095;
+    if (r + rl > a + ml) munmap(a + ml, r + rl - (a + ml));
+    
+    f->map = a;
+    f->map_len = f->len;
+    f->data = a;
+    f->huge = madvise(a, f->len, MADV_HUGEPAGE) == 0 ? FS_HUGE_THP : FS_HUGE_NONE;
+    f->populated = (flags & FS_OPEN_POPULATE) != 0;
+    f->strategy = FS_FILE_MMAP;
+    
+    madvise(a, f->len, MADV_SEQUENTIAL);
+    if (!f->populated) file_register(f);
+    
+    return 0;
+}
+
+FsFile *file_openat(int at, const char *path, int flags, int t) {
+    if (!path) return NULL;
+    
+    int fd = openat(at, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    
+    struct stat st;
+    FsFile *f = calloc(1, sizeof(FsFile));
+    if (!f || fstat(fd, &st) != 0) {
+        free(f);
+        close(fd);
+        return NULL;
+    }
+    
+    f->len = st.st_size;
+    file_faults(&f->minflt, &f->majflt);
+    
+    if (f->len == 0) {
+        f->data = "";
+        f->strategy = FS_FILE_MMAP;
+        close(fd);
+        return f;
+    }
+    
+    int rc = -1;
+    if (!(flags & FS_OPEN_DIRECT)) rc = file_map(f, fd, flags);
+    if (rc != 0) rc = file_read(f, fd, at, path, t);
+    close(fd);
+    
+    if (rc != 0) {
+        free(f);
+        return NULL;
+    }
+    
+    return f;
+}
+
+FsFile *flashsearch_open_file(const char *path, int flags, int t) {
+    return file_openat(AT_FDCWD, path, flags, t);
+}
+
+const char *flashsearch_file_data(const FsFile *f, size_t *len) {
+    if (len) *len = f ? f->len : 0;
+    return f ? f->data : NULL;
+}
+
+void flashsearch_file_stats(const FsFile *f, FsFileStats *st) {
+    memset(st, 0, sizeof(*st));
+    if (!f) return;
+    
+    long mn, mj;
+    file_faults(&mn, &mj);
+    
+    st->strategy = f->strategy;
+    st->huge = f->huge;
+    st->minor_faults = mn - f->minflt;
+    st->major_faults = mj - f->majflt;
+    st->readahead = atomic_load(&((FsFile*)f)->ahead);
+    st->resident = f->len;
+    
+    if (f->strategy != FS_FILE_MMAP || f->len == 0) return;
+    
+    size_t pg = sysconf(_SC_PAGESIZE);
+    size_t np = (f->len + pg - 1) / pg;
+    unsigned char *v = malloc(np);
+    if (!v) return;
+    
+    if (mincore(f->map, f->len, v) == 0) {
+        size_t r = 0;
+        for (size_t i = 0; i < np; i++) r += v[i] & 1;
+        st->resident = r * pg < f->len ? r * pg : f->len;
+    }
+    free(v);
+}
+
+void flashsearch_close_file(FsFile *f) {
+    if (!f) return;
+    file_unregister(f);
+    if (f->map) munmap(f->map, f->map_len);
+    free(f);
+}
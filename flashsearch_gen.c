@@ -0,0 +1,326 @@
+#include "flashsearch_internal.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FS_GEN_BUF (4 * 1024 * 1024)
+#define FS_GEN_REC 160
+
+typedef struct {
+    const FsGen *g;
+    const double *cdf;
+    const int *order;
+    long r0, r1;
+    size_t off;
+    size_t bytes;
+    size_t rmax, cap;
+    size_t *off_out;
+    int fd;
+    long *tags;
+    int err;
+} __attribute__((aligned(64))) GenWorker;
+
+uint64_t gen_hash(uint64_t s, uint64_t x) {
+    x += s + 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+int gen_digits(uint64_t v) {
+    int n = 1;
+    while (v >= 10000) {
+        v /= 10000;
+        n += 4;
+    }
+    return n + (v >= 10) + (v >= 100) + (v >= 1000);
+}
+
+char *gen_u64(char *p, uint64_t v, int w) {
+    static const char dd[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    
+    int n = gen_digits(v);
+    if (n < w) n = w;
+    
+    char *e = p + n;
+    while (v >= 10) {
+        e -= 2;
+        memcpy(e, dd + (v % 100) * 2, 2);
+        v /= 100;
+    }
+    if (v || e > p) *--e = '0' + v;
+    while (e > p) *--e = '0';
+    return p + n;
+}
+
+char *gen_str(char *p, const char *s, size_t n) {
+    memcpy(p, s, n);
+    return p + n;
+}
+
+long gen_tag(const GenWorker *w, long i) {
+    const FsGen *g = w->g;
+    if (!w->cdf) return i % g->tags;
+    
+    double u = (gen_hash(g->seed, i) >> 11) * (1.0 / 9007199254740992.0);
+    long lo = 0, hi = g->tags - 1;
+    while (lo < hi) {
+        long m = (lo + hi) / 2;
+        if (w->cdf[m] < u) lo = m + 1;
+        else hi = m;
+    }
+    return lo;
+}
+
+size_t gen_note(const FsGen *g, long i) {
+    if (g->note_max <= 0 || g->note_pct <= 0) return 0;
+    
+    uint64_t h = gen_hash(g->seed ^ 0x6e6f7465ULL, i);
+    if ((long)(h % 100) >= g->note_pct) return 0;
+    
+    uint64_t u = (h >> 32) % ((uint64_t)g->note_max + 1);
+    return u * u / g->note_max;
+}
+
+size_t gen_len(const GenWorker *w, long i, int *pk) {
+    const FsGen *g = w->g;
+    
+    size_t n = sizeof("{\"id\":,\"key\":\"key\",\"value\":,\"tag\":\"tag\"}") - 1;
+    int kd = gen_digits(i);
+    n += kd + (kd < 8 ? 8 : kd) + gen_digits((uint64_t)i * 3);
+    int td = gen_digits(gen_tag(w, i));
+    n += td < 4 ? 4 : td;
+    
+    size_t nl = gen_note(g, i);
+    if (nl) n += sizeof(",\"note\":\"\"") - 1 + nl;
+    
+    while (*pk < g->nplant && g->plant_rec[w->order[*pk]] == i) {
+        n += sizeof(",\"plant\":\"\"") - 1 + strlen(g->plant[w->order[*pk]]);
+        (*pk)++;
+    }
+    
+    return n;
+}
+
+char *gen_record(GenWorker *w, long i, char *p, size_t at, int *pk) {
+    static const char al[] = "etaoinshrdlucmfwypvbgkjqxz      ";
+    const FsGen *g = w->g;
+    char *b = p;
+    
+    long tag = gen_tag(w, i);
+    if (w->tags) w->tags[tag]++;
+    
+    p = gen_str(p, "{\"id\":", 6);
+    p = gen_u64(p, i, 0);
+    p = gen_str(p, ",\"key\":\"key", 11);
+    p = gen_u64(p, i, 8);
+    p = gen_str(p, "\",\"value\":", 10);
+    p = gen_u64(p, (uint64_t)i * 3, 0);
+    p = gen_str(p, ",\"tag\":\"tag", 11);
+    p = gen_u64(p, tag, 4);
+    *p++ = '"';
+    
+    size_t nl = gen_note(g, i);
+    if (nl) {
+        p = gen_str(p, ",\"note\":\"", 9);
+        uint64_t h = 0;
+        for (size_t k = 0; k < nl; k++) {
+            if (!(k & 7)) h = gen_hash(g->seed, ((uint64_t)i << 20) + k);
+            *p++ = al[h & 31];
+            h >>= 8;
+        }
+        *p++ = '"';
+    }
+    
+    while (*pk < g->nplant && g->plant_rec[w->order[*pk]] == i) {
+        int k = w->order[*pk];
+        p = gen_str(p, ",\"plant\":\"", 10);
+        w->off_out[k] = at + (p - b);
+        p = gen_str(p, g->plant[k], strlen(g->plant[k]));
+        *p++ = '"';
+        (*pk)++;
+    }
+    
+    *p++ = '}';
+    return p;
+}
+
+int gen_first_plant(const GenWorker *w) {
+    int k = 0;
+    while (k < w->g->nplant && w->g->plant_rec[w->order[k]] < w->r0) k++;
+    return k;
+}
+
+void *worker_gen_size(void *arg) {
+    GenWorker *w = (GenWorker*)arg;
+    int pk = gen_first_plant(w);
+    size_t n = 0;
+    
+    for (long i = w->r0; i < w->r1; i++) n += gen_len(w, i, &pk) + 2;
+    if (w->r1 == w->g->records && w->r1 > w->r0) n -= 2;
+    
+    w->bytes = n;
+    return NULL;
+}
+
+int gen_flush(int fd, const char *p, size_t n, size_t at) {
+    while (n) {
+        ssize_t r = pwrite(fd, p, n, at);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        p += r;
+        n -= r;
+        at += r;
+    }
+    return 0;
+}
+
+void *worker_gen_write(void *arg) {
+    GenWorker *w = (GenWorker*)arg;
+    int pk = gen_first_plant(w);
+    
+    char *buf = malloc(w->cap);
+    if (!buf) {
+        w->err = 1;
+        return NULL;
+    }
+    
+    char *p = buf;
+    size_t at = w->off;
+    
+    for (long i = w->r0; i < w->r1; i++) {
+        if ((size_t)(p - buf) + w->rmax > w->cap) {
+            if (gen_flush(w->fd, buf, p - buf, at) < 0) {
+                w->err = 1;
+                break;
+            }
+            at += p - buf;
+            p = buf;
+        }
+        
+        p = gen_record(w, i, p, at + (p - buf), &pk);
+        if (i + 1 < w->g->records) {
+            *p++ = ',';
+            *p++ = '\n';
+        }
+    }
+    
+    if (!w->err && gen_flush(w->fd, buf, p - buf, at) < 0) w->err = 1;
+    
+    free(buf);
+    return NULL;
+}
+
+double *gen_cdf(long n, double s) {
+    double *c = malloc(n * sizeof(double));
+    if (!c) return NULL;
+    
+    double t = 0;
+    for (long k = 0; k < n; k++) {
+        t += pow(k + 1, -s);
+        c[k] = t;
+    }
+    for (long k = 0; k < n; k++) c[k] /= t;
+    c[n - 1] = 1.0;
+    
+    return c;
+}
+
+void flashsearch_gen_init(FsGen *g, long records) {
+    memset(g, 0, sizeof(*g));
+    g->records = records;
+    g->tags = 10000;
+    g->seed = 1;
+}
+
+int flashsearch_generate(FsGen *g, const char *path, int t) {
+    if (!g || !path || g->records < 0 || g->tags < 1) return -1;
+    if (g->nplant < 0 || g->nplant > FS_GEN_PLANTS) return -1;
+    
+    t = find_threads(NULL, t);
+    if (g->records < t) t = g->records > 0 ? (int)g->records : 1;
+    
+    int order[FS_GEN_PLANTS];
+    size_t rmax = FS_GEN_REC + (g->note_max > 0 ? g->note_max : 0);
+    
+    for (int k = 0; k < g->nplant; k++) {
+        g->plant_off[k] = SIZE_MAX;
+        rmax += sizeof(",\"plant\":\"\"") + strlen(g->plant[k]);
+        
+        int j = k;
+        while (j > 0 && g->plant_rec[order[j - 1]] > g->plant_rec[k]) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = k;
+    }
+    
+    double *cdf = NULL;
+    if (g->zipf > 0) {
+        cdf = gen_cdf(g->tags, g->zipf);
+        if (!cdf) return -1;
+    }
+    
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        free(cdf);
+        return -1;
+    }
+    
+    GenWorker ws[MAX_THREADS];
+    memset(ws, 0, sizeof(ws));
+    
+    for (int i = 0; i < t; i++) {
+        ws[i].g = g;
+        ws[i].cdf = cdf;
+        ws[i].order = order;
+        ws[i].off_out = g->plant_off;
+        ws[i].r0 = g->records * i / t;
+        ws[i].r1 = g->records * (i + 1) / t;
+        ws[i].fd = fd;
+        ws[i].rmax = rmax;
+        ws[i].cap = FS_GEN_BUF > 2 * rmax ? FS_GEN_BUF : 2 * rmax;
+    }
+    
+    run_workers(NULL, t, worker_gen_size, ws, sizeof(GenWorker), NULL);
+    
+    size_t at = 2;
+    for (int i = 0; i < t; i++) {
+        ws[i].off = at;
+        at += ws[i].bytes;
+    }
+    g->bytes = at + 3;
+    
+    int err = ftruncate(fd, g->bytes) != 0;
+    
+    for (int i = 0; i < t && !err && g->tag_count; i++) {
+        ws[i].tags = calloc(g->tags, sizeof(long));
+        if (!ws[i].tags) err = 1;
+    }
+    
+    if (!err) {
+        run_workers(NULL, t, worker_gen_write, ws, sizeof(GenWorker), NULL);
+        for (int i = 0; i < t; i++) err |= ws[i].err;
+    }
+    
+    if (!err) err = gen_flush(fd, "[\n", 2, 0) < 0 || gen_flush(fd, "\n]\n", 3, at) < 0;
+    
+    if (g->tag_count) {
+        memset(g->tag_count, 0, g->tags * sizeof(long));
+        for (int i = 0; i < t; i++) {
+            for (long k = 0; ws[i].tags && k < g->tags; k++) g->tag_count[k] += ws[i].tags[k];
+            free(ws[i].tags);
+        }
+    }
+    
+    free(cdf);
+    if (close(fd) != 0) err = 1;
+    
+    return err ? -1 : 0;
+}
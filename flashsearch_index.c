@@ -0,0 +1,335 @@
+#include "flashsearch_internal.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define FS_INDEX_MAGIC "FSIDX02"
+#define FS_INDEX_HEAD 4096
+#define FS_INDEX_SHIFT (32 - __builtin_ctz(FS_INDEX_BITS))
+#define FS_INDEX_TAIL 4096
+
+typedef struct {
+    char magic[8];
+    uint64_t len;
+    uint32_t block;
+    uint32_t bits;
+    uint32_t span;
+    uint32_t pad;
+    uint64_t nblocks;
+    uint64_t tail;
+} FsIndexHeader;
+
+struct FsIndex {
+    void *map;
+    size_t size;
+    const FsIndexHeader *h;
+    const uint8_t *bl;
+    const uint64_t *bh;
+};
+
+typedef struct {
+    const char *data;
+    size_t len;
+    uint8_t *bl;
+    uint64_t *bh;
+    const FsIndex *old;
+    size_t b0, b1;
+    size_t built;
+} __attribute__((aligned(64))) IndexJob;
+
+uint64_t index_hash(const char *d, size_t n) {
+    uint64_t h = 0xcbf29ce484222325ULL ^ n;
+    size_t i = 0;
+    
+    for (; i + 8 <= n; i += 8) {
+        uint64_t x;
+        memcpy(&x, d + i, 8);
+        h = (h ^ x) * 0x100000001b3ULL;
+        h ^= h >> 32;
+    }
+    for (; i < n; i++) {
+        h ^= (unsigned char)d[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h ^ (h >> 29);
+}
+
+uint64_t index_tail(const char *d, size_t l) {
+    size_t n = l < FS_INDEX_TAIL ? l : FS_INDEX_TAIL;
+    return index_hash(d + l - n, n);
+}
+
+uint32_t gram_bit(const char *p) {
+    uint32_t x;
+    memcpy(&x, p, 4);
+    return (x * 0x9E3779B1u) >> FS_INDEX_SHIFT;
+}
+
+size_t index_complete(size_t len) {
+    if (len + 1 < FS_INDEX_SPAN) return 0;
+    return (len + 1 - FS_INDEX_SPAN) / FS_INDEX_BLOCK;
+}
+
+size_t index_end(size_t b, size_t len) {
+    size_t e = b * FS_INDEX_BLOCK + FS_INDEX_BLOCK + FS_INDEX_SPAN - 1;
+    return e < len ? e : len;
+}
+
+void *index_worker(void *arg) {
+    IndexJob *j = (IndexJob*)arg;
+    const FsIndex *o = j->old;
+    size_t bb = FS_INDEX_BITS / 8;
+    
+    for (size_t b = j->b0; b < j->b1; b++) {
+        uint8_t *m = j->bl + b * bb;
+        size_t s = b * FS_INDEX_BLOCK;
+        size_t e = index_end(b, j->len);
+        
+        j->bh[b] = index_hash(j->data + s, e - s);
+        if (o && b < o->h->nblocks && index_end(b, o->h->len) == e && o->bh[b] == j->bh[b]) {
+            memcpy(m, o->bl + b * bb, bb);
+            continue;
+        }
+        
+        j->built++;
+        memset(m, 0, bb);
+        for (size_t i = s; i + 4 <= e; i++) {
+            uint32_t k = gram_bit(j->data + i);
+            m[k >> 3] |= 1 << (k & 7);
+        }
+    }
+    
+    return NULL;
+}
+
+int flashsearch_index_build(FsPool *pool, const char *d, size_t l,
+                            const char *path, int t) {
+    if (!d || !path) return -1;
+    
+    FsIndex *old = flashsearch_index_open(path);
+    
+    size_t bb = FS_INDEX_BITS / 8;
+    size_t nb = (l + FS_INDEX_BLOCK - 1) / FS_INDEX_BLOCK;
+    size_t sz = FS_INDEX_HEAD + nb * (bb + sizeof(uint64_t));
+    
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    
+    int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 || ftruncate(fd, sz) != 0) {
+        if (fd >= 0) close(fd);
+        flashsearch_index_close(old);
+        return -1;
+    }
+    
+    uint8_t *map = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        unlink(tmp);
+        flashsearch_index_close(old);
+        return -1;
+    }
+    
+    uint8_t *bl = map + FS_INDEX_HEAD;
+    
+    t = find_threads(pool, t);
+    IndexJob js[MAX_THREADS];
+    for (int i = 0; i < t; i++) {
+        js[i].data = d;
+        js[i].len = l;
+        js[i].bl = bl;
+        js[i].bh = (uint64_t*)(bl + nb * bb);
+        js[i].old = old;
+        js[i].b0 = nb * i / t;
+        js[i].b1 = nb * (i + 1) / t;
+        js[i].built = 0;
+    }
+    run_workers(pool, t, index_worker, js, sizeof(IndexJob), NULL);
+    
+    size_t built = 0;
+    for (int i = 0; i < t; i++) built += js[i].built;
+    
+    int same = old && old->h->len == l && built == 0;
+    flashsearch_index_close(old);
+    if (same) {
+        munmap(map, sz);
+        unlink(tmp);
+        return 0;
+    }
+    
+    FsIndexHeader *h = (FsIndexHeader*)map;
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, FS_INDEX_MAGIC, sizeof(h->magic));
+    h->len = l;
+    h->block = FS_INDEX_BLOCK;
+    h->bits = FS_INDEX_BITS;
+    h->span = FS_INDEX_SPAN;
+    h->nblocks = nb;
+    h->tail = index_tail(d, l);
+    
+    int rc = msync(map, sz, MS_SYNC);
+    munmap(map, sz);
+    
+    if (rc != 0 || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    
+    return 0;
+}
+
+FsIndex *flashsearch_index_open(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < FS_INDEX_HEAD) {
+        close(fd);
+        return NULL;
+    }
+    
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+    
+    const FsIndexHeader *h = (const FsIndexHeader*)map;
+    size_t bb = FS_INDEX_BITS / 8;
+    
+    if (memcmp(h->magic, FS_INDEX_MAGIC, sizeof(h->magic)) != 0 ||
+        h->block != FS_INDEX_BLOCK || h->bits != FS_INDEX_BITS ||
+        h->span != FS_INDEX_SPAN ||
+        h->nblocks != (h->len + FS_INDEX_BLOCK - 1) / FS_INDEX_BLOCK ||
+        (size_t)st.st_size < FS_INDEX_HEAD + h->nblocks * (bb + sizeof(uint64_t))) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    
+    FsIndex *ix = malloc(sizeof(FsIndex));
+    if (!ix) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    
+    ix->map = map;
+    ix->size = st.st_size;
+    ix->h = h;
+    ix->bl = (const uint8_t*)map + FS_INDEX_HEAD;
+    ix->bh = (const uint64_t*)(ix->bl + h->nblocks * bb);
+    return ix;
+}
+
+void flashsearch_index_close(FsIndex *ix) {
+    if (!ix) return;
+    munmap(ix->map, ix->size);
+    free(ix);
+}
+
+long index_walk(const FsIndex *ix, const char *d, size_t l,
+                const char *p, size_t pl,
+                FsHitFn fn, void *arg, Context *ctx) {
+    ctx_begin(ctx);
+    
+    if (!ix || !d || l < ix->h->len || index_tail(d, ix->h->len) != ix->h->tail) {
+        ctx_end(ctx, d, NULL);
+        return -1;
+    }
+    if (pl == 0 || pl > l) {
+        ctx_end(ctx, d, NULL);
+        return 0;
+    }
+    
+    uint32_t gs[FS_INDEX_SPAN];
+    size_t ng = 0;
+    size_t ql = pl < FS_INDEX_SPAN ? pl : FS_INDEX_SPAN;
+    for (size_t i = 0; i + 4 <= ql; i++) gs[ng++] = gram_bit(p + i);
+    
+    FsNeedle nd;
+    needle_init(&nd, p, pl, 0);
+    
+    size_t bb = FS_INDEX_BITS / 8;
+    size_t kc = index_complete(ix->h->len);
+    if (ix->h->len == l) kc = ix->h->nblocks;
+    size_t nb = (l + FS_INDEX_BLOCK - 1) / FS_INDEX_BLOCK;
+    
+    long cnt = 0;
+    const char *first = NULL;
+    size_t b = 0;
+    
+    while (b < nb) {
+        if (b < kc) {
+            const uint8_t *m = ix->bl + b * bb;
+            size_t g = 0;
+            while (g < ng && (m[gs[g] >> 3] >> (gs[g] & 7) & 1)) g++;
+            if (g < ng) {
+                b++;
+                continue;
+            }
+        }
+        
+        size_t s = b * FS_INDEX_BLOCK;
+        size_t e = s + FS_INDEX_BLOCK;
+        if (e > l) e = l;
+        b++;
+        
+        size_t se = l - e > pl - 1 ? e + pl - 1 : l;
+        stats_bytes(ctx, 0, se - s);
+        
+        for (size_t i = s; i < e && i + pl <= se;) {
+            size_t bs = 0;
+            const char *f = needle_find(d + i, se - i, &nd, NULL, &bs);
+            if (!f || (size_t)(f - d) >= e) break;
+            
+            if (!first) first = f;
+            cnt++;
+            if (fn(f, f - d, arg)) {
+                ctx_end(ctx, d, first);
+                return cnt;
+            }
+            i = f - d + 1;
+        }
+    }
+    
+    ctx_end(ctx, d, first);
+    return cnt;
+}
+
+int index_stop(const char *hit, size_t pos, void *arg) {
+    (void)pos;
+    *(const char**)arg = hit;
+    return 1;
+}
+
+int index_collect(const char *hit, size_t pos, void *arg) {
+    (void)hit;
+    return hits_push((Hits*)arg, pos) < 0;
+}
+
+const char *flashsearch_index_find(const FsIndex *ix, const char *d, size_t l,
+                                   const char *p, size_t pl, Context *ctx) {
+    const char *r = NULL;
+    index_walk(ix, d, l, p, pl, index_stop, &r, ctx);
+    return r;
+}
+
+long flashsearch_index_find_all(const FsIndex *ix, const char *d, size_t l,
+                                const char *p, size_t pl,
+                                size_t **out, Context *ctx) {
+    if (!out) return -1;
+    *out = NULL;
+    
+    Hits hs = {0};
+    long n = index_walk(ix, d, l, p, pl, index_collect, &hs, ctx);
+    
+    if (n < 0 || (size_t)n != hs.n) {
+        free(hs.v);
+        return -1;
+    }
+    
+    *out = hs.v ? hs.v : malloc(sizeof(size_t));
+    if (!*out) return -1;
+    return n;
+}
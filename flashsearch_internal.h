@@ -0,0 +1,108 @@
+#ifndef FLASHSEARCH_INTERNAL_H
+#define FLASHSEARCH_INTERNAL_H
+
+#include "flashsearch.h"
+
+unsigned long long rdtsc();
+
+#define FS_STOP_SLICE (64 * 1024)
+
+#define FS_LONG_NEEDLE 32
+#define FS_LONG_BITS 16
+
+#define FS_FREQ_SAMPLES 64
+#define FS_FREQ_SAMPLE_BYTES 4096
+
+typedef const char *(*FsFindFn)(const char *h, size_t hl,
+                                const struct FsNeedle *nd,
+                                atomic_bool *stop,
+                                size_t *bs);
+
+typedef struct FsNeedle {
+    uint8_t v1[64];
+    uint8_t v2[64];
+    uint8_t f1[64];
+    uint8_t f2[64];
+    const char *n;
+    size_t nl;
+    size_t i1, i2;
+    unsigned int nf;
+    unsigned int nfold;
+    size_t cl;
+    size_t ci;
+    int icase;
+    int kernel;
+    FsFindFn find;
+} __attribute__((aligned(64))) FsNeedle;
+
+struct FsPattern {
+    FsNeedle nd;
+    char *buf;
+    int flags;
+};
+
+typedef struct {
+    size_t *v;
+    size_t n;
+    size_t cap;
+} Hits;
+
+typedef struct {
+    const char *data;
+    size_t len;
+    size_t start, end;
+    const FsNeedle *needle;
+    Hits hits;
+    FsThreadStats stats;
+    int err;
+} __attribute__((aligned(64))) Collector;
+
+extern uint8_t fs_rank[256];
+extern __thread unsigned long long fs_tl_cand;
+extern __thread unsigned long long fs_tl_miss;
+
+void stats_add(Context *ctx, int i, const FsThreadStats *s);
+void stats_bytes(Context *ctx, int i, size_t n);
+void stats_first(Context *ctx, unsigned long long at);
+
+void needle_init(FsNeedle *nd, const char *n, size_t nl, int flags);
+
+const char *needle_find(const char *h, size_t hl,
+                        const FsNeedle *nd,
+                        atomic_bool *stop,
+                        size_t *bs);
+
+void file_ahead(const char *p, size_t n);
+FsFile *file_openat(int at, const char *path, int flags, int t);
+
+int numa_node_of(int i, int t);
+int numa_cpu(int i, int t);
+void pin_cpu(pthread_attr_t *at, int i, int t);
+
+void run_workers(FsPool *pool, int t, void *(*fn)(void*),
+                 void *args, size_t sz, void **rets);
+int find_threads(FsPool *pool, int t);
+
+int hits_push(Hits *hs, size_t v);
+int collect_span(Collector *c, size_t i, size_t lim, size_t se);
+void *worker_all(void *arg);
+int collect_range(FsPool *pool, int t, Collector *cs,
+                  const char *d, size_t l, size_t rs, size_t re,
+                  const FsNeedle *nd, Context *ctx);
+
+void ctx_begin(Context *ctx);
+void ctx_end(Context *ctx, const char *d, const char *res);
+
+const char *search_needle(FsPool *pool,
+                          const char *d, size_t l,
+                          const FsNeedle *nd, int t,
+                          FsCheckFn check, void *args, size_t argsz,
+                          Context *ctx);
+
+const char *search_first(FsPool *pool,
+                         const char *d, size_t l,
+                         const char *p, size_t pl, int t,
+                         FsCheckFn check, void *args, size_t argsz,
+                         Context *ctx);
+
+#endif
@@ -0,0 +1,264 @@
+#include "flashsearch_internal.h"
+#include <string.h>
+#include <stdlib.h>
+#include <x86intrin.h>
+
+#define EVEN_BITS 0x5555555555555555ULL
+
+typedef struct {
+    size_t pos;
+    uint64_t in_str;
+    uint64_t odd;
+    int valid;
+    int is_number;
+    int by_val;
+    const char *key;
+    size_t kl;
+    const char *val;
+    size_t vl;
+} __attribute__((aligned(64))) JsonState;
+
+uint64_t byte_mask(const char *b, char c) {
+    __m128i v = _mm_set1_epi8(c);
+    uint64_t m = 0;
+    for (int k = 0; k < 4; k++) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(b + 16 * k));
+        m |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, v)) << (16 * k);
+    }
+    return m;
+}
+
+uint64_t odd_backslash_ends(uint64_t bs, uint64_t *carry) {
+    uint64_t start_edges = bs & ~(bs << 1);
+    uint64_t even_start_mask = EVEN_BITS ^ *carry;
+    uint64_t even_starts = start_edges & even_start_mask;
+    uint64_t odd_starts = start_edges & ~even_start_mask;
+    uint64_t even_carries = bs + even_starts;
+    
+    unsigned long long odd_carries;
+    bool ends_odd = __builtin_uaddll_overflow(bs, odd_starts, &odd_carries);
+    odd_carries |= *carry;
+    *carry = ends_odd ? 1 : 0;
+    
+    uint64_t even_carry_ends = even_carries & ~bs;
+    uint64_t odd_carry_ends = odd_carries & ~bs;
+    return (even_carry_ends & ~EVEN_BITS) | (odd_carry_ends & EVEN_BITS);
+}
+
+uint64_t prefix_xor(uint64_t x) {
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+uint64_t string_mask(const char *d, size_t l, size_t at,
+                     uint64_t *in_str, uint64_t *odd) {
+    char pad[64];
+    const char *b = d + at;
+    
+    if (at + 64 > l) {
+        memset(pad, ' ', sizeof(pad));
+        memcpy(pad, d + at, l - at);
+        b = pad;
+    }
+    
+    uint64_t esc = odd_backslash_ends(byte_mask(b, '\\'), odd);
+    uint64_t q = byte_mask(b, '"') & ~esc;
+    uint64_t m = prefix_xor(q) ^ *in_str;
+    *in_str = (uint64_t)((int64_t)m >> 63);
+    return m;
+}
+
+int json_outside_string(JsonState *st, const char *d, size_t l, size_t p) {
+    if (!st->valid || st->pos > p) {
+        const char *nl = p ? memrchr(d, '\n', p) : NULL;
+        st->pos = nl ? (size_t)(nl - d) + 1 : 0;
+        st->in_str = 0;
+        st->odd = 0;
+        st->valid = 1;
+    } else if (p > st->pos) {
+        const char *nl = memrchr(d + st->pos, '\n', p - st->pos);
+        if (nl) {
+            st->pos = (size_t)(nl - d) + 1;
+            st->in_str = 0;
+            st->odd = 0;
+        }
+    }
+    
+    while (st->pos + 64 <= p) {
+        string_mask(d, l, st->pos, &st->in_str, &st->odd);
+        st->pos += 64;
+    }
+    
+    if (p == st->pos) return st->in_str == 0;
+    
+    uint64_t in = st->in_str, odd = st->odd;
+    uint64_t m = string_mask(d, l, st->pos, &in, &odd);
+    return ((m >> (p - 1 - st->pos)) & 1) == 0;
+}
+
+int json_is_ws(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+size_t json_key_before(const char *d, size_t p, const JsonState *st) {
+    while (p > 0 && json_is_ws(d[p - 1])) p--;
+    if (p == 0 || d[p - 1] != ':') return SIZE_MAX;
+    p--;
+    while (p > 0 && json_is_ws(d[p - 1])) p--;
+    if (p < st->kl || memcmp(d + p - st->kl, st->key, st->kl) != 0) return SIZE_MAX;
+    return p - st->kl;
+}
+
+int json_check(Worker *w, size_t p) {
+    JsonState *st = (JsonState*)w->arg;
+    const char *d = w->data;
+    size_t k = p, e = p;
+    
+    if (st->by_val) {
+        k = json_key_before(d, p, st);
+        if (k == SIZE_MAX) return 0;
+    } else {
+        e = p + st->kl;
+        while (e < w->len && json_is_ws(d[e])) e++;
+        if (e == w->len || d[e] != ':') return 0;
+        e++;
+        while (e < w->len && json_is_ws(d[e])) e++;
+        if (w->len - e < st->vl || memcmp(d + e, st->val, st->vl) != 0) return 0;
+    }
+    
+    if (st->is_number) {
+        e += st->vl;
+        if (e < w->len && !json_is_ws(d[e]) &&
+            d[e] != ',' && d[e] != '}' && d[e] != ']') return 0;
+    }
+    
+    while (k > 0 && json_is_ws(d[k - 1])) k--;
+    if (k == 0 || (d[k - 1] != '{' && d[k - 1] != ',')) return 0;
+    
+    return json_outside_string(st, d, w->len, p);
+}
+
+size_t json_escape(char *o, const char *s) {
+    static const char hex[] = "0123456789abcdef";
+    size_t n = 0;
+    
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            o[n++] = '\\';
+            o[n++] = c;
+        } else if (c == '\n') {
+            o[n++] = '\\';
+            o[n++] = 'n';
+        } else if (c == '\t') {
+            o[n++] = '\\';
+            o[n++] = 't';
+        } else if (c == '\r') {
+            o[n++] = '\\';
+            o[n++] = 'r';
+        } else if (c < 0x20) {
+            memcpy(o + n, "\\u00", 4);
+            o[n + 4] = hex[c >> 4];
+            o[n + 5] = hex[c & 0xf];
+            n += 6;
+        } else {
+            o[n++] = c;
+        }
+    }
+    
+    return n;
+}
+
+int json_is_literal(const char *v) {
+    if (!strcmp(v, "true") || !strcmp(v, "false") || !strcmp(v, "null")) return 1;
+    
+    const char *s = v;
+    if (*s == '-') s++;
+    if (*s == '0') {
+        s++;
+    } else if (*s >= '1' && *s <= '9') {
+        while (*s >= '0' && *s <= '9') s++;
+    } else {
+        return 0;
+    }
+    if (*s == '.') {
+        s++;
+        if (*s < '0' || *s > '9') return 0;
+        while (*s >= '0' && *s <= '9') s++;
+    }
+    if (*s == 'e' || *s == 'E') {
+        s++;
+        if (*s == '+' || *s == '-') s++;
+        if (*s < '0' || *s > '9') return 0;
+        while (*s >= '0' && *s <= '9') s++;
+    }
+    return *s == '\0';
+}
+
+const char *flashsearch_json_ultimate(const char *d, size_t l,
+                                     const char *field, const char *value,
+                                     int is_number, int t, Context *ctx) {
+    if (!field || !value) return NULL;
+    
+    size_t fl = strlen(field), vl = strlen(value);
+    char *nd = malloc(6 * (fl + vl) + 8);
+    if (!nd) return NULL;
+    
+    size_t n = 0;
+    nd[n++] = '"';
+    n += json_escape(nd + n, field);
+    nd[n++] = '"';
+    
+    size_t v0 = n;
+    if (is_number) {
+        memcpy(nd + n, value, vl);
+        n += vl;
+    } else {
+        nd[n++] = '"';
+        n += json_escape(nd + n, value);
+        nd[n++] = '"';
+    }
+    
+    t = find_threads(NULL, t);
+    
+    JsonState st[MAX_THREADS];
+    memset(st, 0, sizeof(st));
+    for (int i = 0; i < t; i++) {
+        st[i].is_number = is_number;
+        st[i].by_val = n - v0 > v0;
+        st[i].key = nd;
+        st[i].kl = v0;
+        st[i].val = nd + v0;
+        st[i].vl = n - v0;
+    }
+    
+    const char *r;
+    if (st[0].by_val) {
+        r = search_first(NULL, d, l, nd + v0, n - v0, t,
+                         json_check, st, sizeof(JsonState), ctx);
+        if (r) r = d + json_key_before(d, r - d, &st[0]);
+        if (r && ctx) {
+            ctx->result = r;
+            atomic_store(&ctx->position, r - d);
+        }
+    } else {
+        r = search_first(NULL, d, l, nd, v0, t,
+                         json_check, st, sizeof(JsonState), ctx);
+    }
+    
+    free(nd);
+    return r;
+}
+
+const char *flashsearch_json(const char *d, size_t l,
+                            const char *field, const char *value,
+                            int t, Context *ctx) {
+    if (!value) return NULL;
+    return flashsearch_json_ultimate(d, l, field, value,
+                                     json_is_literal(value), t, ctx);
+}
@@ -0,0 +1,287 @@
+#include "flashsearch_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define FS_LINE_BLOCK (256 * 1024)
+
+typedef struct {
+    const char *data;
+    size_t len;
+    size_t start, end;
+    const FsNeedle *needle;
+    int count_only;
+    FsLine *v;
+    size_t n, cap;
+    size_t lines;
+    size_t newlines;
+    FsThreadStats stats;
+    int err;
+} __attribute__((aligned(64))) LineWorker;
+
+size_t scalar_newlines(const char *h, size_t n, size_t *last) {
+    size_t c = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (h[i] == '\n') {
+            c++;
+            *last = i;
+        }
+    }
+    return c;
+}
+
+size_t sse2_newlines(const char *h, size_t n, size_t *last) {
+    __m128i nl = _mm_set1_epi8('\n');
+    size_t c = 0;
+    size_t i = 0;
+    
+    for (; i + 64 <= n; i += 64) {
+        uint64_t m = (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(h + i)), nl)) |
+                     (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(h + i + 16)), nl)) << 16 |
+                     (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(h + i + 32)), nl)) << 32 |
+                     (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(h + i + 48)), nl)) << 48;
+        if (m) {
+            c += __builtin_popcountll(m);
+            *last = i + 63 - __builtin_clzll(m);
+        }
+    }
+    
+    size_t lt = SIZE_MAX;
+    c += scalar_newlines(h + i, n - i, &lt);
+    if (lt != SIZE_MAX) *last = i + lt;
+    return c;
+}
+
+__attribute__((target("avx2,popcnt")))
+size_t avx_newlines(const char *h, size_t n, size_t *last) {
+    __m256i nl = _mm256_set1_epi8('\n');
+    size_t c = 0;
+    size_t i = 0;
+    
+    for (; i + 128 <= n; i += 128) {
+        __m256i c1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(h + i)), nl);
+        __m256i c2 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(h + i + 32)), nl);
+        __m256i c3 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(h + i + 64)), nl);
+        __m256i c4 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(h + i + 96)), nl);
+        
+        uint64_t m12 = (uint32_t)_mm256_movemask_epi8(c1) |
+                       (uint64_t)(uint32_t)_mm256_movemask_epi8(c2) << 32;
+        uint64_t m34 = (uint32_t)_mm256_movemask_epi8(c3) |
+                       (uint64_t)(uint32_t)_mm256_movemask_epi8(c4) << 32;
+        
+        c += _mm_popcnt_u64(m12) + _mm_popcnt_u64(m34);
+        if (m34) *last = i + 127 - __builtin_clzll(m34);
+        else if (m12) *last = i + 63 - __builtin_clzll(m12);
+    }
+    
+    size_t lt = SIZE_MAX;
+    c += scalar_newlines(h + i, n - i, &lt);
+    if (lt != SIZE_MAX) *last = i + lt;
+    return c;
+}
+
+__attribute__((target("avx512f,avx512bw,popcnt")))
+size_t avx512_newlines(const char *h, size_t n, size_t *last) {
+    __m512i nl = _mm512_set1_epi8('\n');
+    size_t c = 0;
+    size_t i = 0;
+    
+    for (; i + 128 <= n; i += 128) {
+        uint64_t m1 = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512((const void*)(h + i)), nl);
+        uint64_t m2 = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512((const void*)(h + i + 64)), nl);
+        
+        c += _mm_popcnt_u64(m1) + _mm_popcnt_u64(m2);
+        if (m2) *last = i + 127 - __builtin_clzll(m2);
+        else if (m1) *last = i + 63 - __builtin_clzll(m1);
+    }
+    
+    size_t lt = SIZE_MAX;
+    c += scalar_newlines(h + i, n - i, &lt);
+    if (lt != SIZE_MAX) *last = i + lt;
+    return c;
+}
+
+size_t count_newlines(const char *h, size_t n, size_t *last) {
+    switch (flashsearch_kernel()) {
+    case FS_KERNEL_AVX512:
+        return avx512_newlines(h, n, last);
+    case FS_KERNEL_AVX2:
+        return avx_newlines(h, n, last);
+    case FS_KERNEL_SSE42:
+        return sse2_newlines(h, n, last);
+    default:
+        return scalar_newlines(h, n, last);
+    }
+}
+
+int lines_push(LineWorker *w, size_t line, size_t s, size_t e) {
+    if (w->n == w->cap) {
+        size_t nc = w->cap ? w->cap * 2 : 1024;
+        FsLine *nv = realloc(w->v, nc * sizeof(FsLine));
+        if (!nv) return -1;
+        w->v = nv;
+        w->cap = nc;
+    }
+    w->v[w->n].line = line;
+    w->v[w->n].start = s;
+    w->v[w->n].end = e;
+    w->n++;
+    return 0;
+}
+
+void *worker_lines(void *arg) {
+    LineWorker *w = (LineWorker*)arg;
+    const char *d = w->data;
+    size_t pl = w->needle->nl;
+    size_t se = w->len - w->end > pl - 1 ? w->end + pl - 1 : w->len;
+    
+    size_t at = w->start;
+    size_t cur = w->start;
+    size_t ls = w->start;
+    size_t nl = 0;
+    
+    w->n = 0;
+    w->lines = 0;
+    w->err = 0;
+    
+    unsigned long long c0 = fs_tl_cand, m0 = fs_tl_miss;
+    memset(&w->stats, 0, sizeof(w->stats));
+    
+    for (size_t bs = w->start; bs < w->end && !w->err; bs += FS_LINE_BLOCK) {
+        size_t be = w->end - bs > FS_LINE_BLOCK ? bs + FS_LINE_BLOCK : w->end;
+        size_t sb = se - be > pl - 1 ? be + pl - 1 : se;
+        
+        while (at < be && at + pl <= sb) {
+            size_t fs = 0;
+            const char *f = needle_find(d + at, sb - at, w->needle, NULL, &fs);
+            if (!f || (size_t)(f - d) >= be) break;
+            
+            size_t p = f - d;
+            const char *eol = memchr(f, '\n', w->len - p);
+            size_t e = eol ? (size_t)(eol - d) : w->len;
+            w->lines++;
+            
+            if (!w->count_only) {
+                size_t last = SIZE_MAX;
+                nl += count_newlines(d + cur, p - cur, &last);
+                if (last != SIZE_MAX) ls = cur + last + 1;
+                
+                if (lines_push(w, nl, ls, e) < 0) {
+                    w->err = 1;
+                    break;
+                }
+                
+                if (eol && e < w->end) nl++;
+                ls = e + 1;
+                cur = e < w->end ? e + 1 : w->end;
+            }
+            
+            at = e + 1;
+        }
+        
+        if (!w->count_only && cur < be) {
+            size_t last = SIZE_MAX;
+            nl += count_newlines(d + cur, be - cur, &last);
+            if (last != SIZE_MAX) ls = cur + last + 1;
+            cur = be;
+        }
+        if (at < be) at = be;
+    }
+    
+    w->newlines = nl;
+    w->stats.bytes = se - w->start;
+    w->stats.chunks = 1;
+    w->stats.candidates = fs_tl_cand - c0;
+    w->stats.false_positives = fs_tl_miss - m0;
+    return NULL;
+}
+
+long lines_run(FsPool *pool, const char *d, size_t l,
+               const char *p, size_t pl, int flags, int t,
+               FsLine **out, Context *ctx) {
+    t = find_threads(pool, t);
+    ctx_begin(ctx);
+    
+    if (!d || !p || pl == 0 || pl > l) {
+        ctx_end(ctx, d, NULL);
+        return 0;
+    }
+    
+    FsNeedle nd;
+    needle_init(&nd, p, pl, flags);
+    
+    LineWorker ws[MAX_THREADS];
+    memset(ws, 0, sizeof(ws));
+    
+    size_t ch = l / t;
+    size_t b = 0;
+    
+    for (int i = 0; i < t; i++) {
+        ws[i].data = d;
+        ws[i].len = l;
+        ws[i].needle = &nd;
+        ws[i].count_only = out == NULL;
+        ws[i].start = b;
+        
+        if (i == t - 1) {
+            b = l;
+        } else if (b < (i + 1) * ch) {
+            const char *eol = memchr(d + (i + 1) * ch, '\n', l - (i + 1) * ch);
+            b = eol ? (size_t)(eol - d) + 1 : l;
+        }
+        ws[i].end = b;
+    }
+    
+    run_workers(pool, t, worker_lines, ws, sizeof(LineWorker), NULL);
+    
+    long r = 0;
+    size_t tot = 0;
+    
+    for (int i = 0; i < t; i++) {
+        stats_add(ctx, i, &ws[i].stats);
+        if (ws[i].err) r = -1;
+        tot += ws[i].lines;
+    }
+    
+    const char *first = NULL;
+    
+    if (r == 0 && out) {
+        FsLine *v = malloc((tot ? tot : 1) * sizeof(FsLine));
+        if (v) {
+            size_t k = 0;
+            size_t base = 1;
+            
+            for (int i = 0; i < t; i++) {
+                for (size_t j = 0; j < ws[i].n; j++) {
+                    v[k] = ws[i].v[j];
+                    v[k].line += base;
+                    k++;
+                }
+                base += ws[i].newlines;
+            }
+            
+            *out = v;
+            if (tot) first = d + v[0].start;
+        } else {
+            r = -1;
+        }
+    }
+    
+    for (int i = 0; i < t; i++) free(ws[i].v);
+    
+    ctx_end(ctx, d, first);
+    return r < 0 ? -1 : (long)tot;
+}
+
+long flashsearch_lines(FsPool *pool, const char *d, size_t l,
+                       const char *p, size_t pl, int flags, int t,
+                       FsLine **out, Context *ctx) {
+    if (!out) return -1;
+    *out = NULL;
+    return lines_run(pool, d, l, p, pl, flags, t, out, ctx);
+}
+
+long flashsearch_count_lines(FsPool *pool, const char *d, size_t l,
+                             const char *p, size_t pl, int flags, int t,
+                             Context *ctx) {
+    return lines_run(pool, d, l, p, pl, flags, t, NULL, ctx);
+}
@@ -0,0 +1,476 @@
+#include "flashsearch_internal.h"
+#include <string.h>
+#include <stdlib.h>
+#include <x86intrin.h>
+
+#define TEDDY_MAX 32
+#define TEDDY_BUCKETS 8
+#define TEDDY_BYTES 3
+
+struct FsMulti {
+    int count;
+    int kind;
+    const char **pats;
+    size_t *lens;
+    size_t minlen, maxlen;
+    char *store;
+    
+    int m;
+    uint8_t lo[TEDDY_BYTES][32];
+    uint8_t hi[TEDDY_BYTES][32];
+    int bucket[TEDDY_BUCKETS][TEDDY_MAX];
+    int bn[TEDDY_BUCKETS];
+    
+    uint32_t *next;
+    uint32_t *out_off;
+    uint32_t *out_n;
+    int *outs;
+    uint32_t states;
+};
+
+typedef struct {
+    FsMatch *v;
+    size_t n;
+    size_t cap;
+} MHits;
+
+typedef struct {
+    const FsMulti *m;
+    const char *data;
+    size_t len;
+    size_t start, end;
+    MHits hits;
+    FsThreadStats stats;
+    int err;
+} __attribute__((aligned(64))) MultiWorker;
+
+int mhits_push(MHits *hs, size_t pos, int id) {
+    if (hs->n == hs->cap) {
+        size_t nc = hs->cap ? hs->cap * 2 : 1024;
+        FsMatch *nv = realloc(hs->v, nc * sizeof(FsMatch));
+        if (!nv) return -1;
+        hs->v = nv;
+        hs->cap = nc;
+    }
+    hs->v[hs->n].pos = pos;
+    hs->v[hs->n].id = id;
+    hs->n++;
+    return 0;
+}
+
+int match_cmp(const void *a, const void *b) {
+    const FsMatch *x = (const FsMatch*)a;
+    const FsMatch *y = (const FsMatch*)b;
+    if (x->pos != y->pos) return x->pos < y->pos ? -1 : 1;
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+void teddy_build(FsMulti *m) {
+    m->m = m->minlen < TEDDY_BYTES ? (int)m->minlen : TEDDY_BYTES;
+    
+    for (int i = 0; i < m->count; i++) {
+        int b = i % TEDDY_BUCKETS;
+        m->bucket[b][m->bn[b]++] = i;
+        
+        for (int k = 0; k < m->m; k++) {
+            uint8_t c = (uint8_t)m->pats[i][k];
+            m->lo[k][c & 0xf] |= 1 << b;
+            m->hi[k][c >> 4] |= 1 << b;
+        }
+    }
+    
+    for (int k = 0; k < m->m; k++) {
+        memcpy(m->lo[k] + 16, m->lo[k], 16);
+        memcpy(m->hi[k] + 16, m->hi[k], 16);
+    }
+}
+
+int ac_build(FsMulti *m) {
+    size_t cap = 1;
+    for (int i = 0; i < m->count; i++) cap += m->lens[i];
+    if (cap > UINT32_MAX / 256) return -1;
+    
+    m->next = calloc(cap * 256, sizeof(uint32_t));
+    uint32_t *fail = calloc(cap, sizeof(uint32_t));
+    int *term = malloc(cap * sizeof(int));
+    uint32_t *q = malloc(cap * sizeof(uint32_t));
+    if (!m->next || !fail || !term || !q) {
+        free(fail);
+        free(term);
+        free(q);
+        return -1;
+    }
+    
+    for (size_t i = 0; i < cap; i++) term[i] = -1;
+    
+    uint32_t ns = 1;
+    int *link = malloc(m->count * sizeof(int));
+    if (!link) {
+        free(fail);
+        free(term);
+        free(q);
+        return -1;
+    }
+    
+    for (int i = 0; i < m->count; i++) {
+        uint32_t s = 0;
+        for (size_t k = 0; k < m->lens[i]; k++) {
+            uint8_t c = (uint8_t)m->pats[i][k];
+            if (!m->next[s * 256 + c]) m->next[s * 256 + c] = ns++;
+            s = m->next[s * 256 + c];
+        }
+        link[i] = term[s];
+        term[s] = i;
+    }
+    
+    m->states = ns;
+    
+    uint32_t qh = 0, qt = 0;
+    for (int c = 0; c < 256; c++) {
+        uint32_t s = m->next[c];
+        if (s) {
+            fail[s] = 0;
+            q[qt++] = s;
+        }
+    }
+    
+    while (qh < qt) {
+        uint32_t s = q[qh++];
+        for (int c = 0; c < 256; c++) {
+            uint32_t t = m->next[s * 256 + c];
+            if (t) {
+                fail[t] = m->next[fail[s] * 256 + c];
+                q[qt++] = t;
+            } else {
+                m->next[s * 256 + c] = m->next[fail[s] * 256 + c];
+            }
+        }
+    }
+    
+    m->out_off = calloc(ns, sizeof(uint32_t));
+    m->out_n = calloc(ns, sizeof(uint32_t));
+    
+    size_t tot = 0;
+    for (uint32_t s = 1; s < ns; s++) {
+        for (uint32_t f = s; f; f = fail[f]) {
+            for (int i = term[f]; i >= 0; i = link[i]) tot++;
+        }
+    }
+    
+    m->outs = malloc((tot ? tot : 1) * sizeof(int));
+    
+    if (m->out_off && m->out_n && m->outs) {
+        uint32_t k = 0;
+        for (uint32_t s = 1; s < ns; s++) {
+            m->out_off[s] = k;
+            for (uint32_t f = s; f; f = fail[f]) {
+                for (int i = term[f]; i >= 0; i = link[i]) m->outs[k++] = i;
+            }
+            m->out_n[s] = k - m->out_off[s];
+        }
+    }
+    
+    free(link);
+    free(fail);
+    free(term);
+    free(q);
+    
+    return (m->out_off && m->out_n && m->outs) ? 0 : -1;
+}
+
+FsMulti *flashsearch_multi_compile(const char *const *patterns,
+                                   const size_t *lens, int count) {
+    if (!patterns || !lens || count < 1) return NULL;
+    
+    FsMulti *m = calloc(1, sizeof(FsMulti));
+    if (!m) return NULL;
+    
+    size_t tot = 0;
+    m->minlen = (size_t)-1;
+    for (int i = 0; i < count; i++) {
+        if (lens[i] == 0) {
+            free(m);
+            return NULL;
+        }
+        tot += lens[i];
+        if (lens[i] < m->minlen) m->minlen = lens[i];
+        if (lens[i] > m->maxlen) m->maxlen = lens[i];
+    }
+    
+    m->count = count;
+    m->pats = malloc(count * sizeof(char*));
+    m->lens = malloc(count * sizeof(size_t));
+    m->store = malloc(tot);
+    if (!m->pats || !m->lens || !m->store) {
+        flashsearch_multi_free(m);
+        return NULL;
+    }
+    
+    size_t off = 0;
+    for (int i = 0; i < count; i++) {
+        memcpy(m->store + off, patterns[i], lens[i]);
+        m->pats[i] = m->store + off;
+        m->lens[i] = lens[i];
+        off += lens[i];
+    }
+    
+    if (count <= TEDDY_MAX && flashsearch_kernel() >= FS_KERNEL_AVX2) {
+        m->kind = FS_MULTI_TEDDY;
+        teddy_build(m);
+    } else {
+        m->kind = FS_MULTI_AC;
+        if (ac_build(m) < 0) {
+            flashsearch_multi_free(m);
+            return NULL;
+        }
+    }
+    
+    return m;
+}
+
+void flashsearch_multi_free(FsMulti *m) {
+    if (!m) return;
+    free(m->next);
+    free(m->out_off);
+    free(m->out_n);
+    free(m->outs);
+    free(m->pats);
+    free(m->lens);
+    free(m->store);
+    free(m);
+}
+
+int flashsearch_multi_kind(const FsMulti *m) {
+    return m ? m->kind : -1;
+}
+
+int teddy_verify(MultiWorker *w, size_t pos, unsigned bits) {
+    const FsMulti *m = w->m;
+    size_t n0 = w->hits.n;
+    
+    w->stats.candidates++;
+    while (bits) {
+        int b = __builtin_ctz(bits);
+        for (int j = 0; j < m->bn[b]; j++) {
+            int id = m->bucket[b][j];
+            size_t pl = m->lens[id];
+            if (pos + pl <= w->len &&
+                memcmp(w->data + pos, m->pats[id], pl) == 0) {
+                if (mhits_push(&w->hits, pos, id) < 0) return -1;
+            }
+        }
+        bits &= bits - 1;
+    }
+    
+    if (w->hits.n == n0) w->stats.false_positives++;
+    return 0;
+}
+
+__attribute__((target("avx2")))
+void teddy_scan(MultiWorker *w) {
+    const FsMulti *m = w->m;
+    const char *h = w->data;
+    __m256i nib = _mm256_set1_epi8(0x0f);
+    __m256i zero = _mm256_setzero_si256();
+    
+    __m256i lo[TEDDY_BYTES], hi[TEDDY_BYTES];
+    for (int k = 0; k < m->m; k++) {
+        lo[k] = _mm256_loadu_si256((const __m256i*)m->lo[k]);
+        hi[k] = _mm256_loadu_si256((const __m256i*)m->hi[k]);
+    }
+    
+    size_t i = w->start;
+    
+    for (; i + 32 + m->m - 1 <= w->len && i + 32 <= w->end; i += 32) {
+        __m256i r = _mm256_set1_epi8((char)0xff);
+        
+        for (int k = 0; k < m->m; k++) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(h + i + k));
+            __m256i l = _mm256_shuffle_epi8(lo[k], _mm256_and_si256(v, nib));
+            __m256i u = _mm256_shuffle_epi8(hi[k],
+                            _mm256_and_si256(_mm256_srli_epi16(v, 4), nib));
+            r = _mm256_and_si256(r, _mm256_and_si256(l, u));
+        }
+        
+        unsigned mask = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(r, zero));
+        if (!mask) continue;
+        
+        uint8_t bk[32];
+        _mm256_storeu_si256((__m256i*)bk, r);
+        
+        while (mask) {
+            int p = __builtin_ctz(mask);
+            if (teddy_verify(w, i + p, bk[p]) < 0) {
+                w->err = 1;
+                return;
+            }
+            mask &= mask - 1;
+        }
+        
+        if (i + 1024 < w->len) {
+            _mm_prefetch(h + i + 1024, _MM_HINT_T0);
+        }
+    }
+    
+    for (; i < w->end; i++) {
+        if (teddy_verify(w, i, (1u << TEDDY_BUCKETS) - 1) < 0) {
+            w->err = 1;
+            return;
+        }
+    }
+}
+
+void ac_scan(MultiWorker *w) {
+    const FsMulti *m = w->m;
+    const uint8_t *h = (const uint8_t*)w->data;
+    
+    size_t i = w->start > m->maxlen - 1 ? w->start - (m->maxlen - 1) : 0;
+    size_t e = w->end + m->maxlen - 1;
+    if (e > w->len) e = w->len;
+    
+    uint32_t s = 0;
+    for (; i < e; i++) {
+        s = m->next[s * 256 + h[i]];
+        uint32_t no = m->out_n[s];
+        if (!no) continue;
+        
+        const int *o = m->outs + m->out_off[s];
+        for (uint32_t k = 0; k < no; k++) {
+            size_t pos = i + 1 - m->lens[o[k]];
+            if (pos < w->start || pos >= w->end) continue;
+            w->stats.candidates++;
+            if (mhits_push(&w->hits, pos, o[k]) < 0) {
+                w->err = 1;
+                return;
+            }
+        }
+    }
+}
+
+void *worker_multi(void *arg) {
+    MultiWorker *w = (MultiWorker*)arg;
+    
+    w->hits.n = 0;
+    w->err = 0;
+    
+    size_t se = w->end + w->m->maxlen - 1;
+    if (se > w->len) se = w->len;
+    memset(&w->stats, 0, sizeof(w->stats));
+    w->stats.bytes = se > w->start ? se - w->start : 0;
+    
+    if (w->start >= w->end) return NULL;
+    w->stats.chunks = 1;
+    
+    if (w->m->kind == FS_MULTI_TEDDY) {
+        teddy_scan(w);
+    } else {
+        ac_scan(w);
+    }
+    
+    if (w->hits.n > 1) {
+        qsort(w->hits.v, w->hits.n, sizeof(FsMatch), match_cmp);
+    }
+    
+    return NULL;
+}
+
+int multi_range(FsPool *pool, int t, MultiWorker *ws, const FsMulti *m,
+                const char *d, size_t l, size_t rs, size_t re,
+                Context *ctx) {
+    size_t ch = (re - rs) / t;
+    
+    for (int i = 0; i < t; i++) {
+        ws[i].m = m;
+        ws[i].data = d;
+        ws[i].len = l;
+        ws[i].start = rs + i * ch;
+        ws[i].end = (i == t - 1) ? re : rs + (i + 1) * ch;
+    }
+    
+    run_workers(pool, t, worker_multi, ws, sizeof(MultiWorker), NULL);
+    
+    for (int i = 0; i < t; i++) {
+        stats_add(ctx, i, &ws[i].stats);
+        if (ws[i].err) return -1;
+    }
+    
+    return 0;
+}
+
+long flashsearch_multi_all(const FsMulti *m, FsPool *pool,
+                           const char *d, size_t l, int t,
+                           FsMatch **out, Context *ctx) {
+    if (out) *out = NULL;
+    if (!m || !out) return -1;
+    
+    t = find_threads(pool, t);
+    ctx_begin(ctx);
+    
+    MultiWorker ws[MAX_THREADS];
+    memset(ws, 0, sizeof(ws));
+    
+    long r = -1;
+    if (multi_range(pool, t, ws, m, d, l, 0, l, ctx) == 0) {
+        size_t tot = 0;
+        for (int i = 0; i < t; i++) tot += ws[i].hits.n;
+        
+        FsMatch *v = malloc((tot ? tot : 1) * sizeof(FsMatch));
+        if (v) {
+            size_t k = 0;
+            for (int i = 0; i < t; i++) {
+                if (ws[i].hits.n) memcpy(v + k, ws[i].hits.v, ws[i].hits.n * sizeof(FsMatch));
+                k += ws[i].hits.n;
+            }
+            *out = v;
+            r = (long)tot;
+        }
+    }
+    
+    for (int i = 0; i < t; i++) free(ws[i].hits.v);
+    
+    ctx_end(ctx, d, (r > 0) ? d + (*out)[0].pos : NULL);
+    return r;
+}
+
+long flashsearch_multi_each(const FsMulti *m, FsPool *pool,
+                            const char *d, size_t l, int t,
+                            FsMultiFn fn, void *arg, Context *ctx) {
+    if (!m || !fn) return -1;
+    
+    t = find_threads(pool, t);
+    ctx_begin(ctx);
+    
+    MultiWorker ws[MAX_THREADS];
+    memset(ws, 0, sizeof(ws));
+    
+    size_t rl = (size_t)t * FS_ROUND_BYTES;
+    long cnt = 0;
+    const char *first = NULL;
+    int quit = 0;
+    
+    for (size_t rs = 0; rs < l && !quit; rs += rl) {
+        size_t re = rs + rl < l ? rs + rl : l;
+        
+        if (multi_range(pool, t, ws, m, d, l, rs, re, ctx) < 0) {
+            cnt = -1;
+            break;
+        }
+        
+        for (int i = 0; i < t && !quit; i++) {
+            for (size_t k = 0; k < ws[i].hits.n; k++) {
+                FsMatch *h = &ws[i].hits.v[k];
+                if (!first) first = d + h->pos;
+                cnt++;
+                if (fn(d + h->pos, h->pos, h->id, arg)) {
+                    quit = 1;
+                    break;
+                }
+            }
+        }
+    }
+    
+    for (int i = 0; i < t; i++) free(ws[i].hits.v);
+    
+    ctx_end(ctx, d, first);
+    return cnt;
+}
@@ -0,0 +1,141 @@
+#include "flashsearch_internal.h"
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#define FS_MPOL_PREFERRED 1
+#define FS_MPOL_MF_MOVE (1 << 1)
+
+typedef struct {
+    int nn;
+    int id[FS_MAX_NODES];
+    int off[FS_MAX_NODES + 1];
+    int cpus[CPU_SETSIZE];
+} Topology;
+
+Topology fs_topo;
+pthread_once_t fs_topo_once = PTHREAD_ONCE_INIT;
+
+int parse_list(const char *path, int *v, int max) {
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    
+    char buf[4096];
+    size_t k = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[k] = '\0';
+    
+    int n = 0;
+    char *s = buf;
+    while (*s && *s != '\n') {
+        char *e;
+        long a = strtol(s, &e, 10);
+        if (e == s) break;
+        long b = a;
+        if (*e == '-') {
+            s = e + 1;
+            b = strtol(s, &e, 10);
+            if (e == s) break;
+        }
+        for (long i = a; i <= b && n < max; i++) v[n++] = (int)i;
+        s = *e == ',' ? e + 1 : e;
+    }
+    
+    return n;
+}
+
+void topo_init(void) {
+    cpu_set_t allow;
+    CPU_ZERO(&allow);
+    if (sched_getaffinity(0, sizeof(allow), &allow) != 0) {
+        int nc = sysconf(_SC_NPROCESSORS_ONLN);
+        for (int i = 0; i < nc && i < CPU_SETSIZE; i++) CPU_SET(i, &allow);
+    }
+    
+    int nodes[FS_MAX_NODES];
+    int nn = parse_list("/sys/devices/system/node/online", nodes, FS_MAX_NODES);
+    
+    int c[CPU_SETSIZE];
+    int nc = 0;
+    
+    for (int k = 0; k < nn; k++) {
+        if (nodes[k] >= FS_MAX_NODES) continue;
+        
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", nodes[k]);
+        
+        int m = parse_list(path, c, CPU_SETSIZE);
+        int b = nc;
+        for (int j = 0; j < m; j++) {
+            if (c[j] < CPU_SETSIZE && CPU_ISSET(c[j], &allow)) fs_topo.cpus[nc++] = c[j];
+        }
+        
+        if (nc > b) {
+            fs_topo.id[fs_topo.nn] = nodes[k];
+            fs_topo.off[fs_topo.nn] = b;
+            fs_topo.nn++;
+        }
+    }
+    
+    if (nc == 0) {
+        for (int i = 0; i < CPU_SETSIZE; i++) {
+            if (CPU_ISSET(i, &allow)) fs_topo.cpus[nc++] = i;
+        }
+        if (nc == 0) fs_topo.cpus[nc++] = 0;
+        fs_topo.nn = 1;
+        fs_topo.id[0] = 0;
+        fs_topo.off[0] = 0;
+    }
+    
+    fs_topo.off[fs_topo.nn] = nc;
+}
+
+int numa_node_of(int i, int t) {
+    pthread_once(&fs_topo_once, topo_init);
+    if (t < 1) t = 1;
+    return (int)((long)i * fs_topo.nn / t);
+}
+
+int numa_cpu(int i, int t) {
+    int k = numa_node_of(i, t);
+    if (t < 1) t = 1;
+    
+    int f = (int)(((long)k * t + fs_topo.nn - 1) / fs_topo.nn);
+    int n = fs_topo.off[k + 1] - fs_topo.off[k];
+    return fs_topo.cpus[fs_topo.off[k] + (i - f) % n];
+}
+
+int flashsearch_numa_nodes(void) {
+    pthread_once(&fs_topo_once, topo_init);
+    return fs_topo.nn;
+}
+
+int flashsearch_numa_place(const void *data, size_t len) {
+    pthread_once(&fs_topo_once, topo_init);
+    if (!data || len == 0 || fs_topo.nn < 2) return 0;
+    
+    size_t pg = sysconf(_SC_PAGESIZE);
+    uintptr_t base = (uintptr_t)data & ~(pg - 1);
+    uintptr_t end = ((uintptr_t)data + len + pg - 1) & ~(pg - 1);
+    size_t span = end - base;
+    int rc = 0;
+    
+    for (int k = 0; k < fs_topo.nn; k++) {
+        uintptr_t a = base + ((span / fs_topo.nn * k) & ~(pg - 1));
+        uintptr_t e = k == fs_topo.nn - 1 ? end :
+                      base + ((span / fs_topo.nn * (k + 1)) & ~(pg - 1));
+        if (a >= e) continue;
+        
+        unsigned long mask[FS_MAX_NODES / 64 + 1];
+        memset(mask, 0, sizeof(mask));
+        mask[fs_topo.id[k] / 64] |= 1UL << (fs_topo.id[k] % 64);
+        
+        if (syscall(SYS_mbind, (void*)a, e - a, FS_MPOL_PREFERRED,
+                    mask, FS_MAX_NODES + 1, FS_MPOL_MF_MOVE) != 0) rc = -1;
+    }
+    
+    return rc;
+}
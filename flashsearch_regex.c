@@ -0,0 +1,1059 @@
+#include "flashsearch_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define RX_SET 0
+#define RX_CAT 1
+#define RX_ALT 2
+#define RX_REP 3
+#define RX_EMPTY 4
+
+#define RX_CLASS 0
+#define RX_SPLIT 1
+#define RX_MATCH 2
+
+#define RX_MAX_NFA 16384
+#define RX_MAX_REP 1000
+#define RX_DFA_STATES 2048
+#define RX_LITS 16
+#define RX_LITLEN 64
+#define RX_INF SIZE_MAX
+
+typedef struct RxNode {
+    int type;
+    uint8_t set[32];
+    struct RxNode **kids;
+    int nk;
+    int min, max;
+} RxNode;
+
+typedef struct {
+    int type;
+    int out, out1;
+    uint8_t set[32];
+} RxState;
+
+typedef struct {
+    int ns;
+    char s[RX_LITS][RX_LITLEN];
+    size_t len[RX_LITS];
+    size_t pre;
+} RxLits;
+
+struct FsRegex {
+    RxState *st;
+    int ns;
+    int start;
+    int icase;
+    int nullable;
+    uint8_t first[256];
+    RxLits lit;
+    FsNeedle nd;
+    FsMulti *multi;
+    size_t maxlit;
+};
+
+typedef struct {
+    const char *p;
+    int icase;
+    int err;
+} RxParser;
+
+int rx_has(const uint8_t *set, int c) {
+    return (set[c >> 3] >> (c & 7)) & 1;
+}
+
+void rx_add(uint8_t *set, int c) {
+    set[c >> 3] |= 1 << (c & 7);
+}
+
+RxNode *rx_node(int type) {
+    RxNode *n = calloc(1, sizeof(RxNode));
+    if (n) n->type = type;
+    return n;
+}
+
+void rx_node_free(RxNode *n) {
+    if (!n) return;
+    for (int i = 0; i < n->nk; i++) rx_node_free(n->kids[i]);
+    free(n->kids);
+    free(n);
+}
+
+int rx_push(RxNode *n, RxNode *k) {
+    RxNode **nk = realloc(n->kids, (n->nk + 1) * sizeof(RxNode*));
+    if (!nk) return -1;
+    n->kids = nk;
+    n->kids[n->nk++] = k;
+    return 0;
+}
+
+void rx_set_range(uint8_t *set, int a, int b) {
+    for (int c = a; c <= b; c++) rx_add(set, c);
+}
+
+int rx_class_escape(uint8_t *set, char e) {
+    uint8_t t[32];
+    memset(t, 0, sizeof(t));
+    
+    switch (e) {
+    case 'd': case 'D':
+        rx_set_range(t, '0', '9');
+        break;
+    case 'w': case 'W':
+        rx_set_range(t, '0', '9');
+        rx_set_range(t, 'a', 'z');
+        rx_set_range(t, 'A', 'Z');
+        rx_add(t, '_');
+        break;
+    case 's': case 'S':
+        rx_add(t, ' ');
+        rx_set_range(t, '\t', '\r');
+        break;
+    default:
+        return 0;
+    }
+    
+    int neg = e >= 'A' && e <= 'Z';
+    for (int i = 0; i < 32; i++) set[i] |= neg ? (uint8_t)~t[i] : t[i];
+    return 1;
+}
+
+int rx_escape_char(char e) {
+    switch (e) {
+    case 'n': return '\n';
+    case 't': return '\t';
+    case 'r': return '\r';
+    case 'f': return '\f';
+    case 'v': return '\v';
+    case '0': return '\0';
+    default: return (unsigned char)e;
+    }
+}
+
+void rx_fold(uint8_t *set) {
+    for (int c = 'a'; c <= 'z'; c++) {
+        if (rx_has(set, c) || rx_has(set, c - 32)) {
+            rx_add(set, c);
+            rx_add(set, c - 32);
+        }
+    }
+}
+
+RxNode *rx_parse_alt(RxParser *ps);
+
+RxNode *rx_parse_class(RxParser *ps) {
+    RxNode *n = rx_node(RX_SET);
+    if (!n) return NULL;
+    
+    int neg = 0;
+    if (*ps->p == '^') {
+        neg = 1;
+        ps->p++;
+    }
+    
+    int first = 1;
+    while (*ps->p && (*ps->p != ']' || first)) {
+        first = 0;
+        int a;
+        
+        if (*ps->p == '\\' && ps->p[1]) {
+            if (rx_class_escape(n->set, ps->p[1])) {
+                ps->p += 2;
+                continue;
+            }
+            a = rx_escape_char(ps->p[1]);
+            ps->p += 2;
+        } else {
+            a = (unsigned char)*ps->p++;
+        }
+        
+        if (*ps->p == '-' && ps->p[1] && ps->p[1] != ']') {
+            ps->p++;
+            int b;
+            if (*ps->p == '\\' && ps->p[1]) {
+                b = rx_escape_char(ps->p[1]);
+                ps->p += 2;
+            } else {
+                b = (unsigned char)*ps->p++;
+            }
+            if (b < a) {
+                ps->err = 1;
+                break;
+            }
+            rx_set_range(n->set, a, b);
+        } else {
+            rx_add(n->set, a);
+        }
+    }
+    
+    if (*ps->p != ']') ps->err = 1;
+    else ps->p++;
+    
+    if (ps->icase) rx_fold(n->set);
+    if (neg) {
+        for (int i = 0; i < 32; i++) n->set[i] = ~n->set[i];
+    }
+    
+    return n;
+}
+
+RxNode *rx_parse_atom(RxParser *ps) {
+    char c = *ps->p;
+    
+    if (c == '(') {
+        ps->p++;
+        if (ps->p[0] == '?' && ps->p[1] == ':') ps->p += 2;
+        RxNode *n = rx_parse_alt(ps);
+        if (*ps->p != ')') ps->err = 1;
+        else ps->p++;
+        return n;
+    }
+    
+    if (c == '[') {
+        ps->p++;
+        return rx_parse_class(ps);
+    }
+    
+    if (c == '^' || c == '$' || c == '*' || c == '+' || c == '?' || c == '{') {
+        ps->err = 1;
+        return NULL;
+    }
+    
+    RxNode *n = rx_node(RX_SET);
+    if (!n) return NULL;
+    ps->p++;
+    
+    if (c == '.') {
+        memset(n->set, 0xff, sizeof(n->set));
+        n->set['\n' >> 3] &= ~(1 << ('\n' & 7));
+    } else if (c == '\\') {
+        char e = *ps->p;
+        if (!e) {
+            ps->err = 1;
+            return n;
+        }
+        ps->p++;
+        if (!rx_class_escape(n->set, e)) rx_add(n->set, rx_escape_char(e));
+    } else {
+        rx_add(n->set, (unsigned char)c);
+    }
+    
+    if (ps->icase) rx_fold(n->set);
+    return n;
+}
+
+int rx_parse_int(RxParser *ps) {
+    if (*ps->p < '0' || *ps->p > '9') return -1;
+    int v = 0;
+    while (*ps->p >= '0' && *ps->p <= '9') {
+        v = v * 10 + (*ps->p++ - '0');
+        if (v > RX_MAX_REP) return -2;
+    }
+    return v;
+}
+
+RxNode *rx_parse_repeat(RxParser *ps) {
+    RxNode *n = rx_parse_atom(ps);
+    
+    while (n && !ps->err) {
+        int mn, mx;
+        char c = *ps->p;
+        
+        if (c == '*') {
+            mn = 0;
+            mx = -1;
+        } else if (c == '+') {
+            mn = 1;
+            mx = -1;
+        } else if (c == '?') {
+            mn = 0;
+            mx = 1;
+        } else if (c == '{') {
+            ps->p++;
+            mn = rx_parse_int(ps);
+            mx = mn;
+            if (*ps->p == ',') {
+                ps->p++;
+                mx = *ps->p == '}' ? -1 : rx_parse_int(ps);
+                if (mx == -1 && *ps->p != '}') mx = -2;
+            }
+            if (mn < 0 || mx < -1 || *ps->p != '}' || (mx >= 0 && mx < mn)) {
+                ps->err = 1;
+                break;
+            }
+        } else {
+            break;
+        }
+        ps->p++;
+        
+        RxNode *r = rx_node(RX_REP);
+        if (!r || rx_push(r, n) < 0) {
+            free(r);
+            ps->err = 1;
+            break;
+        }
+        r->min = mn;
+        r->max = mx;
+        n = r;
+    }
+    
+    return n;
+}
+
+RxNode *rx_parse_cat(RxParser *ps) {
+    RxNode *n = rx_node(RX_CAT);
+    if (!n) {
+        ps->err = 1;
+        return NULL;
+    }
+    
+    while (*ps->p && *ps->p != '|' && *ps->p != ')' && !ps->err) {
+        RxNode *k = rx_parse_repeat(ps);
+        if (!k || rx_push(n, k) < 0) {
+            rx_node_free(k);
+            ps->err = 1;
+        }
+    }
+    
+    if (n->nk == 0) n->type = RX_EMPTY;
+    return n;
+}
+
+RxNode *rx_parse_alt(RxParser *ps) {
+    RxNode *n = rx_parse_cat(ps);
+    
+    while (n && *ps->p == '|' && !ps->err) {
+        ps->p++;
+        if (n->type != RX_ALT) {
+            RxNode *a = rx_node(RX_ALT);
+            if (!a || rx_push(a, n) < 0) {
+                free(a);
+                ps->err = 1;
+                break;
+            }
+            n = a;
+        }
+        RxNode *k = rx_parse_cat(ps);
+        if (!k || rx_push(n, k) < 0) {
+            rx_node_free(k);
+            ps->err = 1;
+        }
+    }
+    
+    return n;
+}
+
+int rx_state(FsRegex *re, int type, int out, int out1, const uint8_t *set) {
+    if (re->ns >= RX_MAX_NFA) return -1;
+    RxState *s = &re->st[re->ns];
+    s->type = type;
+    s->out = out;
+    s->out1 = out1;
+    if (set) memcpy(s->set, set, sizeof(s->set));
+    return re->ns++;
+}
+
+int rx_compile(FsRegex *re, const RxNode *n, int next) {
+    if (next < 0) return -1;
+    
+    switch (n->type) {
+    case RX_SET:
+        return rx_state(re, RX_CLASS, next, -1, n->set);
+    case RX_EMPTY:
+        return next;
+    case RX_CAT:
+        for (int i = n->nk - 1; i >= 0; i--) next = rx_compile(re, n->kids[i], next);
+        return next;
+    case RX_ALT: {
+        int s = rx_compile(re, n->kids[n->nk - 1], next);
+        for (int i = n->nk - 2; i >= 0 && s >= 0; i--) {
+            int k = rx_compile(re, n->kids[i], next);
+            s = k < 0 ? -1 : rx_state(re, RX_SPLIT, k, s, NULL);
+        }
+        return s;
+    }
+    case RX_REP: {
+        const RxNode *k = n->kids[0];
+        int cur = next;
+        
+        if (n->max < 0) {
+            int sp = rx_state(re, RX_SPLIT, -1, next, NULL);
+            if (sp < 0) return -1;
+            int b = rx_compile(re, k, sp);
+            if (b < 0) return -1;
+            re->st[sp].out = b;
+            cur = sp;
+        } else {
+            for (int i = n->min; i < n->max && cur >= 0; i++) {
+                int b = rx_compile(re, k, cur);
+                cur = b < 0 ? -1 : rx_state(re, RX_SPLIT, b, next, NULL);
+            }
+        }
+        
+        for (int i = 0; i < n->min && cur >= 0; i++) cur = rx_compile(re, k, cur);
+        return cur;
+    }
+    }
+    
+    return -1;
+}
+
+size_t rx_sat_add(size_t a, size_t b) {
+    return (a == RX_INF || b == RX_INF || a + b < a) ? RX_INF : a + b;
+}
+
+size_t rx_maxlen(const RxNode *n) {
+    size_t m = 0;
+    
+    switch (n->type) {
+    case RX_SET:
+        return 1;
+    case RX_CAT:
+        for (int i = 0; i < n->nk; i++) m = rx_sat_add(m, rx_maxlen(n->kids[i]));
+        return m;
+    case RX_ALT:
+        for (int i = 0; i < n->nk; i++) {
+            size_t k = rx_maxlen(n->kids[i]);
+            if (k > m) m = k;
+        }
+        return m;
+    case RX_REP:
+        if (n->max < 0) return rx_maxlen(n->kids[0]) ? RX_INF : 0;
+        for (int i = 0; i < n->max; i++) m = rx_sat_add(m, rx_maxlen(n->kids[0]));
+        return m;
+    }
+    
+    return 0;
+}
+
+int rx_set_chars(const uint8_t *set, int icase, char *out) {
+    int k = 0;
+    for (int c = 0; c < 256; c++) {
+        if (!rx_has(set, c)) continue;
+        if (icase && c >= 'A' && c <= 'Z' && rx_has(set, c + 32)) continue;
+        if (k == RX_LITS) return -1;
+        out[k++] = (char)c;
+    }
+    return k;
+}
+
+int rx_product(RxLits *a, const RxLits *b) {
+    if (a->ns * b->ns > RX_LITS) return -1;
+    
+    RxLits r;
+    r.ns = 0;
+    for (int i = 0; i < a->ns; i++) {
+        for (int j = 0; j < b->ns; j++) {
+            if (a->len[i] + b->len[j] > RX_LITLEN) return -1;
+            memcpy(r.s[r.ns], a->s[i], a->len[i]);
+            memcpy(r.s[r.ns] + a->len[i], b->s[j], b->len[j]);
+            r.len[r.ns++] = a->len[i] + b->len[j];
+        }
+    }
+    
+    r.pre = a->pre;
+    *a = r;
+    return 0;
+}
+
+int rx_exact(const RxNode *n, int icase, RxLits *out) {
+    out->ns = 1;
+    out->len[0] = 0;
+    out->pre = 0;
+    
+    switch (n->type) {
+    case RX_EMPTY:
+        return 0;
+    case RX_SET: {
+        char cs[RX_LITS];
+        int k = rx_set_chars(n->set, icase, cs);
+        if (k <= 0) return -1;
+        for (int i = 0; i < k; i++) {
+            out->s[i][0] = cs[i];
+            out->len[i] = 1;
+        }
+        out->ns = k;
+        return 0;
+    }
+    case RX_CAT: {
+        RxLits *k = malloc(sizeof(RxLits));
+        if (!k) return -1;
+        int rc = 0;
+        for (int i = 0; i < n->nk && rc == 0; i++) {
+            rc = rx_exact(n->kids[i], icase, k);
+            if (rc == 0) rc = rx_product(out, k);
+        }
+        free(k);
+        return rc;
+    }
+    case RX_ALT: {
+        RxLits *k = malloc(sizeof(RxLits));
+        if (!k) return -1;
+        out->ns = 0;
+        int rc = 0;
+        for (int i = 0; i < n->nk && rc == 0; i++) {
+            rc = rx_exact(n->kids[i], icase, k);
+            if (rc == 0 && out->ns + k->ns > RX_LITS) rc = -1;
+            for (int j = 0; rc == 0 && j < k->ns; j++) {
+                memcpy(out->s[out->ns], k->s[j], k->len[j]);
+                out->len[out->ns++] = k->len[j];
+            }
+        }
+        free(k);
+        return rc;
+    }
+    case RX_REP: {
+        if (n->max < 0 || n->max != n->min) return -1;
+        RxLits *k = malloc(sizeof(RxLits));
+        if (!k) return -1;
+        int rc = rx_exact(n->kids[0], icase, k);
+        for (int i = 0; i < n->min && rc == 0; i++) rc = rx_product(out, k);
+        free(k);
+        return rc;
+    }
+    }
+    
+    return -1;
+}
+
+size_t rx_minlen(const RxLits *l) {
+    size_t m = RX_INF;
+    for (int i = 0; i < l->ns; i++) {
+        if (l->len[i] < m) m = l->len[i];
+    }
+    return l->ns ? m : 0;
+}
+
+void rx_consider(RxLits *best, const RxLits *c) {
+    if (c->ns == 0 || rx_minlen(c) == 0) return;
+    if (best->ns == 0) {
+        *best = *c;
+        return;
+    }
+    
+    int cb = c->pre != RX_INF, bb = best->pre != RX_INF;
+    if (cb != bb) {
+        if (cb) *best = *c;
+        return;
+    }
+    
+    size_t cm = rx_minlen(c), bm = rx_minlen(best);
+    if (c->ns == 1 && cm >= 3) cm += 2;
+    if (best->ns == 1 && bm >= 3) bm += 2;
+    if (cm > bm || (cm == bm && c->ns < best->ns)) *best = *c;
+}
+
+void rx_factor(const RxNode *n, int icase, RxLits *best) {
+    best->ns = 0;
+    best->pre = RX_INF;
+    
+    RxLits *t = malloc(2 * sizeof(RxLits));
+    if (!t) return;
+    RxLits *k = t, *run = t + 1;
+    
+    if (rx_exact(n, icase, k) == 0) {
+        k->pre = 0;
+        rx_consider(best, k);
+        free(t);
+        return;
+    }
+    
+    if (n->type == RX_CAT) {
+        size_t off = 0;
+        run->ns = 1;
+        run->len[0] = 0;
+        run->pre = 0;
+        
+        for (int i = 0; i < n->nk; i++) {
+            const RxNode *c = n->kids[i];
+            size_t ml = rx_maxlen(c);
+            
+            if (rx_exact(c, icase, k) == 0) {
+                if (rx_product(run, k) < 0) {
+                    rx_consider(best, run);
+                    *run = *k;
+                    run->pre = off;
+                }
+            } else {
+                rx_consider(best, run);
+                rx_factor(c, icase, k);
+                k->pre = rx_sat_add(k->pre, off);
+                rx_consider(best, k);
+                run->ns = 1;
+                run->len[0] = 0;
+                run->pre = rx_sat_add(off, ml);
+            }
+            off = rx_sat_add(off, ml);
+        }
+        rx_consider(best, run);
+    } else if (n->type == RX_ALT) {
+        RxLits *u = malloc(sizeof(RxLits));
+        if (u) {
+            u->ns = 0;
+            u->pre = 0;
+            int ok = 1;
+            for (int i = 0; i < n->nk && ok; i++) {
+                rx_factor(n->kids[i], icase, k);
+                if (k->ns == 0 || u->ns + k->ns > RX_LITS) {
+                    ok = 0;
+                    break;
+                }
+                for (int j = 0; j < k->ns; j++) {
+                    memcpy(u->s[u->ns], k->s[j], k->len[j]);
+                    u->len[u->ns++] = k->len[j];
+                }
+                if (k->pre > u->pre) u->pre = k->pre;
+            }
+            if (ok) rx_consider(best, u);
+            free(u);
+        }
+    } else if (n->type == RX_REP && n->min >= 1) {
+        rx_factor(n->kids[0], icase, k);
+        rx_consider(best, k);
+    }
+    
+    free(t);
+}
+
+typedef struct {
+    const FsRegex *re;
+    int unanch;
+    int n;
+    int *next;
+    int *soff, *slen;
+    uint8_t *acc;
+    int *pool;
+    size_t pn, pcap;
+    int *ht;
+    int start;
+    int *buf, *stk;
+    uint32_t *mark;
+    uint32_t gen;
+} RxDfa;
+
+int rx_dfa_init(RxDfa *d, const FsRegex *re, int unanch) {
+    memset(d, 0, sizeof(*d));
+    d->re = re;
+    d->unanch = unanch;
+    d->start = -1;
+    d->next = malloc((size_t)RX_DFA_STATES * 256 * sizeof(int));
+    d->soff = malloc(RX_DFA_STATES * sizeof(int));
+    d->slen = malloc(RX_DFA_STATES * sizeof(int));
+    d->acc = malloc(RX_DFA_STATES);
+    d->ht = malloc(2 * RX_DFA_STATES * sizeof(int));
+    d->buf = malloc(re->ns * sizeof(int));
+    d->stk = malloc(re->ns * sizeof(int));
+    d->mark = calloc(re->ns, sizeof(uint32_t));
+    d->pcap = 4096;
+    d->pool = malloc(d->pcap * sizeof(int));
+    
+    if (!d->next || !d->soff || !d->slen || !d->acc || !d->ht ||
+        !d->buf || !d->stk || !d->mark || !d->pool) return -1;
+    
+    memset(d->ht, -1, 2 * RX_DFA_STATES * sizeof(int));
+    return 0;
+}
+
+void rx_dfa_free(RxDfa *d) {
+    free(d->next);
+    free(d->soff);
+    free(d->slen);
+    free(d->acc);
+    free(d->ht);
+    free(d->buf);
+    free(d->stk);
+    free(d->mark);
+    free(d->pool);
+}
+
+void rx_dfa_flush(RxDfa *d) {
+    d->n = 0;
+    d->pn = 0;
+    d->start = -1;
+    memset(d->ht, -1, 2 * RX_DFA_STATES * sizeof(int));
+}
+
+int rx_closure(RxDfa *d, int s, int k) {
+    const RxState *st = d->re->st;
+    int sp = 0;
+    
+    if (s < 0 || d->mark[s] == d->gen) return k;
+    d->mark[s] = d->gen;
+    d->stk[sp++] = s;
+    
+    while (sp > 0) {
+        int x = d->stk[--sp];
+        if (st[x].type != RX_SPLIT) {
+            d->buf[k++] = x;
+            continue;
+        }
+        
+        int o[2] = { st[x].out1, st[x].out };
+        for (int i = 0; i < 2; i++) {
+            if (o[i] >= 0 && d->mark[o[i]] != d->gen) {
+                d->mark[o[i]] = d->gen;
+                d->stk[sp++] = o[i];
+            }
+        }
+    }
+    
+    return k;
+}
+
+int rx_cmp_int(const void *a, const void *b) {
+    return *(const int*)a - *(const int*)b;
+}
+
+int rx_dfa_add(RxDfa *d, int k) {
+    if (k == 0) return -1;
+    qsort(d->buf, k, sizeof(int), rx_cmp_int);
+    
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < k; i++) h = (h ^ (uint32_t)d->buf[i]) * 16777619u;
+    
+    size_t hm = 2 * RX_DFA_STATES - 1;
+    for (size_t i = h & hm;; i = (i + 1) & hm) {
+        int s = d->ht[i];
+        if (s < 0) break;
+        if (d->slen[s] == k && !memcmp(d->pool + d->soff[s], d->buf, k * sizeof(int))) return s;
+    }
+    
+    if (d->n == RX_DFA_STATES) rx_dfa_flush(d);
+    
+    if (d->pn + k > d->pcap) {
+        size_t nc = d->pcap;
+        while (d->pn + k > nc) nc *= 2;
+        int *np = realloc(d->pool, nc * sizeof(int));
+        if (!np) return -2;
+        d->pool = np;
+        d->pcap = nc;
+    }
+    
+    int s = d->n++;
+    d->soff[s] = d->pn;
+    d->slen[s] = k;
+    memcpy(d->pool + d->pn, d->buf, k * sizeof(int));
+    d->pn += k;
+    
+    d->acc[s] = 0;
+    for (int i = 0; i < k; i++) {
+        if (d->re->st[d->buf[i]].type == RX_MATCH) d->acc[s] = 1;
+    }
+    
+    int *row = d->next + (size_t)s * 256;
+    for (int c = 0; c < 256; c++) row[c] = -2;
+    
+    for (size_t i = h & hm;; i = (i + 1) & hm) {
+        if (d->ht[i] < 0) {
+            d->ht[i] = s;
+            break;
+        }
+    }
+    
+    return s;
+}
+
+int rx_dfa_start(RxDfa *d) {
+    if (d->start < 0) {
+        d->gen++;
+        d->start = rx_dfa_add(d, rx_closure(d, d->re->start, 0));
+    }
+    return d->start;
+}
+
+int rx_dfa_step(RxDfa *d, int s, uint8_t c) {
+    int t = d->next[(size_t)s * 256 + c];
+    if (t != -2) return t;
+    
+    const RxState *st = d->re->st;
+    const int *set = d->pool + d->soff[s];
+    int n = d->slen[s];
+    int k = 0;
+    
+    d->gen++;
+    for (int i = 0; i < n; i++) {
+        const RxState *x = &st[set[i]];
+        if (x->type == RX_CLASS && rx_has(x->set, c)) k = rx_closure(d, x->out, k);
+    }
+    if (d->unanch) k = rx_closure(d, d->re->start, k);
+    
+    int keep = d->n < RX_DFA_STATES;
+    t = rx_dfa_add(d, k);
+    if (keep && t != -2) d->next[(size_t)s * 256 + c] = t;
+    return t;
+}
+
+size_t rx_longest(RxDfa *d, const char *h, size_t l, size_t s) {
+    int q = rx_dfa_start(d);
+    size_t last = d->acc[q] ? s : RX_INF;
+    
+    for (size_t i = s; i < l && q >= 0; i++) {
+        q = rx_dfa_step(d, q, (uint8_t)h[i]);
+        if (q >= 0 && d->acc[q]) last = i + 1;
+    }
+    
+    return last;
+}
+
+int rx_dfa_move(RxDfa *from, int q, RxDfa *to) {
+    int k = from->slen[q];
+    memcpy(to->buf, from->pool + from->soff[q], k * sizeof(int));
+    return rx_dfa_add(to, k);
+}
+
+size_t rx_earliest(RxDfa *un, RxDfa *an, const char *h, size_t l,
+                   size_t s, size_t stop) {
+    RxDfa *d = un;
+    int q = rx_dfa_start(d);
+    if (q >= 0 && d->acc[q]) return s;
+    
+    for (size_t i = s; i < l && q >= 0; i++) {
+        if (i == stop) {
+            q = rx_dfa_move(un, q, an);
+            d = an;
+            if (q < 0) break;
+        }
+        q = rx_dfa_step(d, q, (uint8_t)h[i]);
+        if (q >= 0 && d->acc[q]) return i + 1;
+    }
+    
+    return RX_INF;
+}
+
+typedef struct {
+    const FsRegex *re;
+    const char *data;
+    size_t len;
+    size_t start, end;
+    atomic_size_t *best;
+    size_t mend;
+    size_t next;
+    RxDfa fwd;
+    int found;
+    FsThreadStats stats;
+} __attribute__((aligned(64))) RxWorker;
+
+int rx_try(RxWorker *w, size_t a, size_t b) {
+    if (a < w->next) a = w->next;
+    
+    for (size_t s = a; s <= b; s++) {
+        if (s >= atomic_load(w->best)) return 1;
+        if (!w->re->nullable && (s >= w->len || !w->re->first[(uint8_t)w->data[s]])) continue;
+        
+        size_t e = rx_longest(&w->fwd, w->data, w->len, s);
+        if (e != RX_INF) {
+            size_t bb = atomic_load(w->best);
+            while (s < bb && !atomic_compare_exchange_weak(w->best, &bb, s));
+            w->mend = e;
+            w->found = 1;
+            return 1;
+        }
+    }
+    
+    if (b + 1 > w->next) w->next = b + 1;
+    return 0;
+}
+
+int rx_window(RxWorker *w, size_t p) {
+    size_t pre = w->re->lit.pre;
+    size_t a = p > pre ? p - pre : 0;
+    if (a < w->start) a = w->start;
+    size_t b = p < w->end - 1 ? p : w->end - 1;
+    if (a > b) return 0;
+    
+    w->stats.candidates++;
+    int r = rx_try(w, a, b);
+    if (!r) w->stats.false_positives++;
+    return r;
+}
+
+int rx_multi_hit(const char *hit, size_t pos, int id, void *arg) {
+    (void)pos;
+    (void)id;
+    RxWorker *w = (RxWorker*)arg;
+    return rx_window(w, (size_t)(hit - w->data));
+}
+
+void rx_scan_literal(RxWorker *w) {
+    const FsRegex *re = w->re;
+    size_t se = w->end - 1;
+    se = rx_sat_add(se, re->lit.pre);
+    se = rx_sat_add(se, re->maxlit);
+    if (se > w->len) se = w->len;
+    w->stats.bytes = se - w->start;
+    
+    if (re->multi) {
+        flashsearch_multi_each(re->multi, NULL, w->data + w->start, se - w->start,
+                               1, rx_multi_hit, w, NULL);
+        return;
+    }
+    
+    size_t at = w->start;
+    while (at + re->nd.nl <= se) {
+        size_t bs = 0;
+        const char *f = needle_find(w->data + at, se - at, &re->nd, NULL, &bs);
+        if (!f) break;
+        size_t p = f - w->data;
+        if (p >= w->end + re->lit.pre || rx_window(w, p)) break;
+        at = p + 1;
+    }
+}
+
+void rx_scan_dfa(RxWorker *w) {
+    RxDfa un;
+    if (rx_dfa_init(&un, w->re, 1) < 0) {
+        rx_dfa_free(&un);
+        rx_try(w, w->start, w->end - 1);
+        return;
+    }
+    
+    size_t from = w->start;
+    while (from < w->end && from < atomic_load(w->best)) {
+        size_t e = rx_earliest(&un, &w->fwd, w->data, w->len, from, w->end);
+        w->stats.bytes = (e == RX_INF ? w->len : e) - w->start;
+        if (e == RX_INF) break;
+        
+        size_t b = e < w->end - 1 ? e : w->end - 1;
+        w->stats.candidates++;
+        if (rx_try(w, from, b)) break;
+        w->stats.false_positives++;
+        from = b + 1;
+    }
+    
+    rx_dfa_free(&un);
+}
+
+void *worker_regex(void *arg) {
+    RxWorker *w = (RxWorker*)arg;
+    w->found = 0;
+    w->next = w->start;
+    memset(&w->stats, 0, sizeof(w->stats));
+    
+    if (w->start >= w->end) return NULL;
+    w->stats.chunks = 1;
+    if (rx_dfa_init(&w->fwd, w->re, 0) == 0) {
+        if (w->re->lit.ns > 0) rx_scan_literal(w);
+        else rx_scan_dfa(w);
+    }
+    rx_dfa_free(&w->fwd);
+    
+    return NULL;
+}
+
+FsRegex *flashsearch_regex_compile(const char *expr, int flags) {
+    if (!expr) return NULL;
+    
+    RxParser ps = { expr, (flags & FS_ICASE) != 0, 0 };
+    RxNode *root = rx_parse_alt(&ps);
+    if (!root || ps.err || *ps.p) {
+        rx_node_free(root);
+        return NULL;
+    }
+    
+    FsRegex *re = aligned_alloc(64, (sizeof(FsRegex) + 63) & ~(size_t)63);
+    if (!re) {
+        rx_node_free(root);
+        return NULL;
+    }
+    memset(re, 0, sizeof(FsRegex));
+    re->icase = ps.icase;
+    re->st = malloc(RX_MAX_NFA * sizeof(RxState));
+    
+    int m = re->st ? rx_state(re, RX_MATCH, -1, -1, NULL) : -1;
+    re->start = rx_compile(re, root, m);
+    
+    if (re->start < 0) {
+        rx_node_free(root);
+        flashsearch_regex_free(re);
+        return NULL;
+    }
+    
+    rx_factor(root, re->icase, &re->lit);
+    if (re->lit.pre == RX_INF || (re->lit.ns > 1 && re->icase)) re->lit.ns = 0;
+    rx_node_free(root);
+    
+    for (int i = 0; i < re->lit.ns; i++) {
+        if (re->lit.len[i] > re->maxlit) re->maxlit = re->lit.len[i];
+    }
+    
+    if (re->lit.ns == 1) {
+        needle_init(&re->nd, re->lit.s[0], re->lit.len[0], re->icase ? FS_ICASE : 0);
+    } else if (re->lit.ns > 1) {
+        const char *lits[RX_LITS];
+        for (int i = 0; i < re->lit.ns; i++) lits[i] = re->lit.s[i];
+        re->multi = flashsearch_multi_compile(lits, re->lit.len, re->lit.ns);
+        if (!re->multi) re->lit.ns = 0;
+    }
+    
+    RxDfa d;
+    if (rx_dfa_init(&d, re, 0) < 0) {
+        rx_dfa_free(&d);
+        flashsearch_regex_free(re);
+        return NULL;
+    }
+    
+    int q = rx_dfa_start(&d);
+    re->nullable = q >= 0 && d.acc[q];
+    for (int c = 0; c < 256 && q >= 0; c++) {
+        re->first[c] = rx_dfa_step(&d, q, (uint8_t)c) >= 0;
+        q = rx_dfa_start(&d);
+    }
+    rx_dfa_free(&d);
+    
+    return re;
+}
+
+void flashsearch_regex_free(FsRegex *re) {
+    if (!re) return;
+    flashsearch_multi_free(re->multi);
+    free(re->st);
+    free(re);
+}
+
+const char *flashsearch_regex_find(const FsRegex *re, FsPool *pool,
+                                   const char *d, size_t l, int t,
+                                   size_t *match_len, Context *ctx) {
+    if (match_len) *match_len = 0;
+    if (!re || !d) return NULL;
+    
+    t = find_threads(pool, t);
+    ctx_begin(ctx);
+    
+    RxWorker *ws = aligned_alloc(64, t * sizeof(RxWorker));
+    if (!ws) {
+        ctx_end(ctx, d, NULL);
+        return NULL;
+    }
+    
+    atomic_size_t best;
+    atomic_store(&best, SIZE_MAX);
+    
+    size_t ch = l / t;
+    for (int i = 0; i < t; i++) {
+        ws[i].re = re;
+        ws[i].data = d;
+        ws[i].len = l;
+        ws[i].start = i * ch;
+        ws[i].end = (i == t - 1) ? l + 1 : (i + 1) * ch;
+        ws[i].best = &best;
+    }
+    
+    run_workers(pool, t, worker_regex, ws, sizeof(RxWorker), NULL);
+    
+    size_t b = atomic_load(&best);
+    const char *res = NULL;
+    
+    for (int i = 0; i < t; i++) {
+        stats_add(ctx, i, &ws[i].stats);
+        if (res == NULL && ws[i].found && b != SIZE_MAX &&
+            b >= ws[i].start && b < ws[i].end) {
+            res = d + b;
+            if (match_len) *match_len = ws[i].mend - b;
+        }
+    }
+    
+    free(ws);
+    ctx_end(ctx, d, res);
+    return res;
+}
@@ -0,0 +1,213 @@
+#include "flashsearch_internal.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct {
+    char *buf;
+    size_t n;
+    int full;
+    int eof;
+} StreamSlot;
+
+typedef struct {
+    int fd;
+    int reg;
+    StreamSlot slots[FS_STREAM_SLOTS];
+    size_t pre, cap;
+    pthread_mutex_t mtx;
+    pthread_cond_t cv;
+    int quit;
+    int err;
+} Stream;
+
+size_t stream_fill(Stream *s, char *b) {
+    size_t n = 0;
+    
+    while (n < s->cap) {
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        ssize_t r = read(s->fd, b + n, s->cap - n);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            s->err = 1;
+            break;
+        }
+        if (r == 0) break;
+        n += r;
+        
+        if (!s->reg && n < s->cap) {
+            struct pollfd pf = { .fd = s->fd, .events = POLLIN };
+            if (poll(&pf, 1, 0) == 0) break;
+        }
+    }
+    
+    return n;
+}
+
+void *stream_reader(void *arg) {
+    Stream *s = (Stream*)arg;
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    
+    for (int k = 0;; k = (k + 1) % FS_STREAM_SLOTS) {
+        StreamSlot *sl = &s->slots[k];
+        
+        pthread_mutex_lock(&s->mtx);
+        while (sl->full && !s->quit) pthread_cond_wait(&s->cv, &s->mtx);
+        int q = s->quit;
+        pthread_mutex_unlock(&s->mtx);
+        if (q) break;
+        
+        size_t n = stream_fill(s, sl->buf + s->pre);
+        
+        pthread_mutex_lock(&s->mtx);
+        sl->n = n;
+        sl->eof = n == 0 || s->err;
+        sl->full = 1;
+        pthread_cond_broadcast(&s->cv);
+        pthread_mutex_unlock(&s->mtx);
+        
+        if (sl->eof) break;
+    }
+    
+    return NULL;
+}
+
+long flashsearch_stream_fd(FsPool *pool, int fd,
+                           const char *p, size_t pl, int flags, int t,
+                           FsHitFn fn, void *arg, Context *ctx) {
+    if (!fn || fd < 0) return -1;
+    
+    ctx_begin(ctx);
+    if (pl == 0) {
+        ctx_end(ctx, NULL, NULL);
+        return 0;
+    }
+    
+    FsPool *own = NULL;
+    if (!pool && t > 1) pool = own = flashsearch_pool_create(t);
+    t = find_threads(pool, t);
+    
+    Stream s;
+    memset(&s, 0, sizeof(s));
+    s.fd = fd;
+    s.cap = FS_STREAM_BLOCK;
+    s.pre = (pl - 1 + 4095) & ~(size_t)4095;
+    
+    struct stat sb;
+    s.reg = fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode);
+    if (s.reg) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    
+    long cnt = -1;
+    char *carry = malloc(pl);
+    int ok = carry != NULL;
+    for (int k = 0; k < FS_STREAM_SLOTS && ok; k++) {
+        s.slots[k].buf = aligned_alloc(4096, s.pre + s.cap);
+        ok = s.slots[k].buf != NULL;
+    }
+    
+    pthread_t rd;
+    if (ok) {
+        pthread_mutex_init(&s.mtx, NULL);
+        pthread_cond_init(&s.cv, NULL);
+        ok = pthread_create(&rd, NULL, stream_reader, &s) == 0;
+        if (!ok) {
+            pthread_mutex_destroy(&s.mtx);
+            pthread_cond_destroy(&s.cv);
+        }
+    }
+    
+    if (ok) {
+        FsNeedle nd;
+        needle_init(&nd, p, pl, flags);
+        
+        Collector cs[MAX_THREADS];
+        memset(cs, 0, sizeof(cs));
+        
+        size_t base = 0, cn = 0;
+        int quit = 0;
+        cnt = 0;
+        
+        for (int k = 0; !quit; k = (k + 1) % FS_STREAM_SLOTS) {
+            StreamSlot *sl = &s.slots[k];
+            
+            pthread_mutex_lock(&s.mtx);
+            while (!sl->full) pthread_cond_wait(&s.cv, &s.mtx);
+            pthread_mutex_unlock(&s.mtx);
+            
+            if (sl->n > 0) {
+                char *d = sl->buf + s.pre - cn;
+                size_t l = cn + sl->n;
+                memcpy(d, carry, cn);
+                
+                if (l >= pl) {
+                    if (collect_range(pool, t, cs, d, l, 0, l, &nd, ctx) < 0) {
+                        cnt = -1;
+                        break;
+                    }
+                    
+                    for (int i = 0; i < t && !quit; i++) {
+                        for (size_t j = 0; j < cs[i].hits.n; j++) {
+                            size_t pos = base - cn + cs[i].hits.v[j];
+                            if (cnt++ == 0 && ctx) {
+                                atomic_store(&ctx->found, true);
+                                atomic_store(&ctx->position, pos);
+                            }
+                            if (fn(d + cs[i].hits.v[j], pos, arg)) {
+                                quit = 1;
+                                break;
+                            }
+                        }
+                    }
+                }
+                
+                cn = l < pl - 1 ? l : pl - 1;
+                memcpy(carry, d + l - cn, cn);
+                base += sl->n;
+            }
+            
+            int eof = sl->eof;
+            pthread_mutex_lock(&s.mtx);
+            sl->full = 0;
+            pthread_cond_broadcast(&s.cv);
+            pthread_mutex_unlock(&s.mtx);
+            if (eof) break;
+        }
+        
+        if (s.err) cnt = -1;
+        
+        pthread_mutex_lock(&s.mtx);
+        s.quit = 1;
+        pthread_cond_broadcast(&s.cv);
+        pthread_mutex_unlock(&s.mtx);
+        pthread_cancel(rd);
+        pthread_join(rd, NULL);
+        
+        pthread_mutex_destroy(&s.mtx);
+        pthread_cond_destroy(&s.cv);
+        for (int i = 0; i < t; i++) free(cs[i].hits.v);
+    }
+    
+    for (int k = 0; k < FS_STREAM_SLOTS; k++) free(s.slots[k].buf);
+    free(carry);
+    if (own) flashsearch_pool_destroy(own);
+    
+    ctx_end(ctx, NULL, NULL);
+    return cnt;
+}
+
+long flashsearch_stream_file(FsPool *pool, const char *path,
+                             const char *p, size_t pl, int flags, int t,
+                             FsHitFn fn, void *arg, Context *ctx) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    
+    long r = flashsearch_stream_fd(pool, fd, p, pl, flags, t, fn, arg, ctx);
+    close(fd);
+    return r;
+}
@@ -0,0 +1,691 @@
+#include "flashsearch_internal.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define FS_TREE_DENTS (32 * 1024)
+#define FS_TREE_SNIFF 8192
+#define FS_TREE_IGNORE_MAX (1024 * 1024)
+
+typedef struct {
+    const char *p;
+    int neg;
+    int dir;
+    int anch;
+} Rule;
+
+typedef struct Ignore {
+    struct Ignore *up;
+    struct Ignore *next;
+    char *buf;
+    size_t base;
+    Rule *r;
+    int n;
+} Ignore;
+
+typedef struct {
+    size_t path, name;
+    size_t dir;
+    size_t size;
+    size_t at, n;
+    int w;
+    int big;
+} TreeFile;
+
+typedef struct {
+    size_t path, name;
+    size_t up;
+    int fd;
+    int files;
+    Ignore *ig;
+} TreeDir;
+
+typedef struct {
+    FsTree *tr;
+    Ignore user;
+    Ignore *igs;
+    char *arena;
+    size_t an, acap;
+    TreeFile *fs;
+    size_t nf, fcap;
+    TreeDir *ds;
+    size_t nd, dcap;
+    size_t fds, fdmax;
+} Walk;
+
+typedef struct {
+    const Walk *wk;
+    TreeFile *fs;
+    const FsNeedle *nd;
+    atomic_size_t *next;
+    int id;
+    int flags;
+    size_t split;
+    char *buf;
+    size_t cap;
+    Hits hits;
+    FsThreadStats stats;
+    unsigned long long first;
+    long skipped;
+    int err;
+} __attribute__((aligned(64))) TreeWorker;
+
+struct linux_dirent64 {
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+int glob_match(const char *p, const char *s) {
+    for (;;) {
+        switch (*p) {
+        case 0:
+            return !*s;
+        case '*':
+            if (p[1] == '*') {
+                p += 2;
+                int sl = *p == '/';
+                if (sl) p++;
+                for (;;) {
+                    if (glob_match(p, s)) return 1;
+                    if (!*s) return 0;
+                    if (sl) {
+                        s = strchr(s, '/');
+                        if (!s) return 0;
+                    }
+                    s++;
+                }
+            }
+            p++;
+            for (;;) {
+                if (glob_match(p, s)) return 1;
+                if (!*s || *s == '/') return 0;
+                s++;
+            }
+        case '?':
+            if (!*s || *s == '/') return 0;
+            p++;
+            s++;
+            break;
+        case '[': {
+            if (!*s || *s == '/') return 0;
+            const char *q = p + 1;
+            int neg = *q == '!' || *q == '^';
+            if (neg) q++;
+            int hit = 0;
+            do {
+                unsigned char lo = *q, hi = lo;
+                if (!lo) return 0;
+                if (q[1] == '-' && q[2] && q[2] != ']') {
+                    hi = q[2];
+                    q += 3;
+                } else {
+                    q++;
+                }
+                if ((unsigned char)*s >= lo && (unsigned char)*s <= hi) hit = 1;
+            } while (*q != ']');
+            if (hit == neg) return 0;
+            p = q + 1;
+            s++;
+            break;
+        }
+        case '\\':
+            if (p[1]) p++;
+            /* fall through */
+        default:
+            if (*p != *s) return 0;
+            p++;
+            s++;
+        }
+    }
+}
+
+int rule_parse(Rule *r, char *l) {
+    size_t n = strlen(l);
+    if (n && l[n - 1] == '\r') l[--n] = 0;
+    while (n && l[n - 1] == ' ' && (n < 2 || l[n - 2] != '\\')) l[--n] = 0;
+    if (!n || l[0] == '#') return 0;
+    
+    memset(r, 0, sizeof(*r));
+    if (l[0] == '!') {
+        r->neg = 1;
+        l++;
+        n--;
+    }
+    if (n && l[n - 1] == '/') {
+        r->dir = 1;
+        l[--n] = 0;
+    }
+    if (!n) return 0;
+    
+    r->anch = strchr(l, '/') != NULL;
+    if (l[0] == '/') l++;
+    r->p = l;
+    return 1;
+}
+
+int ignore_parse(Ignore *ig, char *buf) {
+    int cap = 1;
+    for (char *c = buf; *c; c++) cap += *c == '\n';
+    
+    ig->r = malloc(cap * sizeof(Rule));
+    if (!ig->r) return -1;
+    
+    char *l = buf;
+    while (l) {
+        char *e = strchr(l, '\n');
+        if (e) *e++ = 0;
+        if (rule_parse(&ig->r[ig->n], l)) ig->n++;
+        l = e;
+    }
+    return 0;
+}
+
+int ignore_hit(const Ignore *ig, const char *full, const char *name, int dir) {
+    for (int k = ig->n - 1; k >= 0; k--) {
+        const Rule *r = &ig->r[k];
+        if (r->dir && !dir) continue;
+        if (glob_match(r->p, r->anch ? full + ig->base : name)) return r->neg ? 0 : 1;
+    }
+    return -1;
+}
+
+int walk_skip(const Walk *wk, const Ignore *ig, const char *full, const char *name, int dir) {
+    int fl = wk->tr->flags;
+    
+    if (name[0] == '.' && (!(fl & FS_TREE_HIDDEN) || (dir && !strcmp(name, ".git")))) return 1;
+    
+    int r = ignore_hit(&wk->user, full, name, dir);
+    if (r >= 0) return r;
+    
+    for (; ig; ig = ig->up) {
+        r = ignore_hit(ig, full, name, dir);
+        if (r >= 0) return r;
+    }
+    return 0;
+}
+
+size_t walk_str(Walk *wk, const char *s, size_t n) {
+    if (wk->an + n + 1 > wk->acap) {
+        size_t nc = wk->acap ? wk->acap : 64 * 1024;
+        while (wk->an + n + 1 > nc) nc *= 2;
+        char *na = realloc(wk->arena, nc);
+        if (!na) return SIZE_MAX;
+        wk->arena = na;
+        wk->acap = nc;
+    }
+    size_t at = wk->an;
+    memcpy(wk->arena + at, s, n);
+    wk->arena[at + n] = 0;
+    wk->an += n + 1;
+    return at;
+}
+
+int walk_file(Walk *wk, const char *path, size_t n, size_t nm, size_t dir) {
+    if (wk->nf == wk->fcap) {
+        size_t nc = wk->fcap ? wk->fcap * 2 : 1024;
+        TreeFile *nv = realloc(wk->fs, nc * sizeof(TreeFile));
+        if (!nv) return -1;
+        wk->fs = nv;
+        wk->fcap = nc;
+    }
+    size_t at = walk_str(wk, path, n);
+    if (at == SIZE_MAX) return -1;
+    
+    TreeFile *f = &wk->fs[wk->nf++];
+    memset(f, 0, sizeof(*f));
+    f->path = at;
+    f->name = at + nm;
+    f->dir = dir;
+    f->w = -1;
+    return 0;
+}
+
+int walk_dir(Walk *wk, const char *path, size_t n, size_t nm, size_t up, Ignore *ig) {
+    if (wk->nd == wk->dcap) {
+        size_t nc = wk->dcap ? wk->dcap * 2 : 256;
+        TreeDir *nv = realloc(wk->ds, nc * sizeof(TreeDir));
+        if (!nv) return -1;
+        wk->ds = nv;
+        wk->dcap = nc;
+    }
+    size_t at = walk_str(wk, path, n);
+    if (at == SIZE_MAX) return -1;
+    
+    TreeDir *d = &wk->ds[wk->nd++];
+    d->path = at;
+    d->name = at + nm;
+    d->up = up;
+    d->fd = -1;
+    d->files = 0;
+    d->ig = ig;
+    return 0;
+}
+
+Ignore *walk_ignore(Walk *wk, int dfd, Ignore *up, size_t base) {
+    int fd = openat(dfd, ".gitignore", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return up;
+    
+    struct stat st;
+    Ignore *ig = NULL;
+    char *buf = NULL;
+    
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size < FS_TREE_IGNORE_MAX) {
+        buf = malloc(st.st_size + 1);
+        ig = calloc(1, sizeof(Ignore));
+    }
+    
+    ssize_t r = buf && ig ? read(fd, buf, st.st_size) : -1;
+    close(fd);
+    
+    if (r < 0) {
+        free(buf);
+        free(ig);
+        return up;
+    }
+    
+    buf[r] = 0;
+    ig->buf = buf;
+    ig->up = up;
+    ig->base = base;
+    ig->next = wk->igs;
+    wk->igs = ig;
+    
+    if (ignore_parse(ig, buf) < 0 || ig->n == 0) return up;
+    return ig;
+}
+
+int walk_at(const Walk *wk, size_t dir, size_t path, size_t name, const char **nm) {
+    int fd = dir != SIZE_MAX ? wk->ds[dir].fd : -1;
+    *nm = wk->arena + (fd >= 0 ? name : path);
+    return fd >= 0 ? fd : AT_FDCWD;
+}
+
+int walk_one(Walk *wk, size_t di, char *sp, char *db) {
+    TreeDir d = wk->ds[di];
+    size_t pl = strlen(wk->arena + d.path);
+    memcpy(sp, wk->arena + d.path, pl + 1);
+    
+    const char *dn;
+    int at = walk_at(wk, d.up, d.path, d.name, &dn);
+    int dfd = openat(at, dn, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd < 0) return 0;
+    wk->tr->dirs++;
+    
+    if (pl == 0 || sp[pl - 1] != '/') sp[pl++] = '/';
+    
+    Ignore *ig = d.ig;
+    if (!(wk->tr->flags & FS_TREE_NO_IGNORE)) ig = walk_ignore(wk, dfd, ig, pl);
+    
+    int err = 0;
+    size_t kids = 0;
+    for (;;) {
+        long nr = syscall(SYS_getdents64, dfd, db, FS_TREE_DENTS);
+        if (nr <= 0) break;
+        
+        for (long o = 0; o < nr && !err;) {
+            struct linux_dirent64 *e = (struct linux_dirent64*)(db + o);
+            o += e->d_reclen;
+            
+            const char *nm = e->d_name;
+            if (nm[0] == '.' && (!nm[1] || (nm[1] == '.' && !nm[2]))) continue;
+            
+            int ty = e->d_type;
+            if (ty == DT_UNKNOWN) {
+                struct stat st;
+                if (fstatat(dfd, nm, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+                ty = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_LNK;
+            }
+            if (ty != DT_DIR && ty != DT_REG) continue;
+            
+            size_t nl = strlen(nm);
+            if (pl + nl >= PATH_MAX) {
+                wk->tr->skipped++;
+                continue;
+            }
+            memcpy(sp + pl, nm, nl + 1);
+            
+            if (walk_skip(wk, ig, sp, nm, ty == DT_DIR)) {
+                wk->tr->skipped++;
+                continue;
+            }
+            
+            if (ty == DT_DIR) {
+                err = walk_dir(wk, sp, pl + nl, pl, di, ig) < 0;
+                kids++;
+            } else {
+                err = walk_file(wk, sp, pl + nl, pl, di) < 0;
+                wk->ds[di].files++;
+            }
+        }
+        if (err) break;
+    }
+    
+    if ((kids || wk->ds[di].files) && wk->fds < wk->fdmax) {
+        wk->ds[di].fd = dfd;
+        wk->fds++;
+    } else {
+        close(dfd);
+    }
+    return err ? -1 : 0;
+}
+
+int walk_tree(Walk *wk, const char *root) {
+    size_t rl = strlen(root);
+    while (rl > 1 && root[rl - 1] == '/') rl--;
+    if (rl == 0 || rl >= PATH_MAX) return -1;
+    
+    struct stat st;
+    if (stat(root, &st) != 0) return -1;
+    if (S_ISREG(st.st_mode)) return walk_file(wk, root, rl, 0, SIZE_MAX);
+    if (!S_ISDIR(st.st_mode)) return -1;
+    
+    struct rlimit lim;
+    wk->fdmax = 1024;
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur != RLIM_INFINITY) wk->fdmax = lim.rlim_cur / 2;
+    
+    char *sp = malloc(PATH_MAX + FS_TREE_DENTS);
+    if (!sp || walk_dir(wk, root, rl, 0, SIZE_MAX, NULL) < 0) {
+        free(sp);
+        return -1;
+    }
+    
+    wk->user.base = rl + (root[rl - 1] != '/');
+    
+    int err = 0;
+    for (size_t i = 0; i < wk->nd && !err; i++) {
+        err = walk_one(wk, i, sp, sp + PATH_MAX) < 0;
+    }
+    
+    for (size_t i = 0; i < wk->nd; i++) {
+        if (wk->ds[i].fd >= 0 && !wk->ds[i].files) {
+            close(wk->ds[i].fd);
+            wk->ds[i].fd = -1;
+        }
+    }
+    
+    free(sp);
+    return err ? -1 : 0;
+}
+
+void walk_free(Walk *wk) {
+    for (size_t i = 0; i < wk->nd; i++) {
+        if (wk->ds[i].fd >= 0) close(wk->ds[i].fd);
+    }
+    while (wk->igs) {
+        Ignore *n = wk->igs->next;
+        free(wk->igs->buf);
+        free(wk->igs->r);
+        free(wk->igs);
+        wk->igs = n;
+    }
+    free(wk->user.r);
+    free(wk->user.buf);
+    free(wk->arena);
+    free(wk->fs);
+    free(wk->ds);
+}
+
+int tree_binary(const char *d, size_t n) {
+    return memchr(d, 0, n < FS_TREE_SNIFF ? n : FS_TREE_SNIFF) != NULL;
+}
+
+int tree_scan(TreeWorker *w, TreeFile *f, const char *d, size_t n) {
+    Collector c;
+    memset(&c, 0, sizeof(c));
+    c.data = d;
+    c.len = n;
+    c.needle = w->nd;
+    c.hits = w->hits;
+    f->at = c.hits.n;
+    
+    if (w->flags & FS_TREE_FIRST) {
+        size_t bs = 0;
+        const char *r = n >= w->nd->nl ? needle_find(d, n, w->nd, NULL, &bs) : NULL;
+        if (r && hits_push(&c.hits, r - d) < 0) c.err = 1;
+    } else {
+        c.err = collect_span(&c, 0, n, n) < 0;
+    }
+    
+    w->hits = c.hits;
+    f->n = c.hits.n - f->at;
+    f->w = w->id;
+    
+    if (f->n && !w->first) w->first = rdtsc();
+    return c.err ? -1 : 0;
+}
+
+void *worker_tree(void *arg) {
+    TreeWorker *w = (TreeWorker*)arg;
+    unsigned long long c0 = fs_tl_cand, m0 = fs_tl_miss;
+    
+    for (;;) {
+        size_t i = atomic_fetch_add(w->next, 1);
+        if (i >= w->wk->nf) break;
+        
+        TreeFile *f = &w->fs[i];
+        const char *nm;
+        int at = walk_at(w->wk, f->dir, f->path, f->name, &nm);
+        int fd = openat(at, nm, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) continue;
+        
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            continue;
+        }
+        
+        f->size = st.st_size;
+        if (f->size >= w->split) {
+            f->big = 1;
+            close(fd);
+            continue;
+        }
+        
+        if (f->size + 1 > w->cap) {
+            size_t nc = w->cap ? w->cap : 64 * 1024;
+            while (f->size + 1 > nc) nc *= 2;
+            char *nb = realloc(w->buf, nc);
+            if (!nb) {
+                close(fd);
+                w->err = 1;
+                break;
+            }
+            w->buf = nb;
+            w->cap = nc;
+        }
+        
+        size_t n = 0;
+        while (n < f->size) {
+            ssize_t r = read(fd, w->buf + n, f->size - n);
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) break;
+            n += r;
+        }
+        close(fd);
+        f->size = n;
+        
+        if (!(w->flags & FS_TREE_BINARY) && tree_binary(w->buf, n)) {
+            w->skipped++;
+            continue;
+        }
+        
+        w->stats.bytes += n;
+        w->stats.chunks++;
+        if (tree_scan(w, f, w->buf, n) < 0) {
+            w->err = 1;
+            break;
+        }
+    }
+    
+    w->stats.candidates = fs_tl_cand - c0;
+    w->stats.false_positives = fs_tl_miss - m0;
+    return NULL;
+}
+
+int tree_big(FsPool *pool, int t, TreeWorker *bw, TreeFile *f, Context *ctx) {
+    const char *nm;
+    int at = walk_at(bw->wk, f->dir, f->path, f->name, &nm);
+    FsFile *ff = file_openat(at, nm, 0, t);
+    if (!ff) return 0;
+    
+    size_t l;
+    const char *d = flashsearch_file_data(ff, &l);
+    f->size = l;
+    
+    if (!(bw->flags & FS_TREE_BINARY) && tree_binary(d, l)) {
+        bw->skipped++;
+        flashsearch_close_file(ff);
+        return 0;
+    }
+    
+    int err = 0;
+    if (bw->flags & FS_TREE_FIRST) {
+        const char *r = l >= bw->nd->nl ?
+            search_needle(pool, d, l, bw->nd, t, NULL, NULL, 0, NULL) : NULL;
+        f->at = bw->hits.n;
+        if (r) err = hits_push(&bw->hits, r - d) < 0;
+        f->n = bw->hits.n - f->at;
+        f->w = bw->id;
+        bw->stats.bytes += l;
+    } else if (l >= bw->nd->nl) {
+        Collector cs[MAX_THREADS];
+        memset(cs, 0, sizeof(cs));
+        
+        err = collect_range(pool, t, cs, d, l, 0, l, bw->nd, ctx) < 0;
+        f->at = bw->hits.n;
+        for (int i = 0; i < t && !err; i++) {
+            for (size_t j = 0; j < cs[i].hits.n && !err; j++) {
+                err = hits_push(&bw->hits, cs[i].hits.v[j]) < 0;
+            }
+        }
+        for (int i = 0; i < t; i++) free(cs[i].hits.v);
+        f->n = bw->hits.n - f->at;
+        f->w = bw->id;
+    }
+    
+    if (f->n && !bw->first) bw->first = rdtsc();
+    flashsearch_close_file(ff);
+    return err ? -1 : 0;
+}
+
+void flashsearch_tree_init(FsTree *tr) {
+    memset(tr, 0, sizeof(*tr));
+    tr->split = FS_TREE_SPLIT;
+}
+
+long flashsearch_tree(FsPool *pool, const char *root,
+                      const char *p, size_t pl, FsTree *tr,
+                      int t, FsPathFn fn, void *arg, Context *ctx) {
+    if (!root || !tr || pl == 0) return -1;
+    if (tr->nfilter < 0 || tr->nfilter > FS_TREE_FILTERS) return -1;
+    
+    t = find_threads(pool, t);
+    ctx_begin(ctx);
+    
+    tr->files = tr->matched = tr->skipped = tr->dirs = 0;
+    tr->bytes = 0;
+    
+    Walk wk;
+    memset(&wk, 0, sizeof(wk));
+    wk.tr = tr;
+    
+    size_t fl = 0;
+    for (int k = 0; k < tr->nfilter; k++) fl += strlen(tr->filter[k]) + 1;
+    
+    wk.user.buf = malloc(fl + 1);
+    wk.user.r = malloc((tr->nfilter + 1) * sizeof(Rule));
+    if (!wk.user.buf || !wk.user.r) {
+        walk_free(&wk);
+        ctx_end(ctx, NULL, NULL);
+        return -1;
+    }
+    
+    char *ub = wk.user.buf;
+    for (int k = 0; k < tr->nfilter; k++) {
+        size_t n = strlen(tr->filter[k]);
+        memcpy(ub, tr->filter[k], n + 1);
+        if (!strchr(ub, '\n') && rule_parse(&wk.user.r[wk.user.n], ub)) wk.user.n++;
+        ub += n + 1;
+    }
+    
+    if (walk_tree(&wk, root) < 0) {
+        walk_free(&wk);
+        ctx_end(ctx, NULL, NULL);
+        return -1;
+    }
+    
+    FsNeedle nd;
+    needle_init(&nd, p, pl, tr->flags);
+    
+    size_t split = tr->split ? tr->split : FS_TREE_SPLIT;
+    atomic_size_t next = 0;
+    
+    TreeWorker ws[MAX_THREADS + 1];
+    memset(ws, 0, sizeof(ws));
+    
+    for (int i = 0; i <= t; i++) {
+        ws[i].wk = &wk;
+        ws[i].fs = wk.fs;
+        ws[i].nd = &nd;
+        ws[i].next = &next;
+        ws[i].id = i;
+        ws[i].flags = tr->flags;
+        ws[i].split = split;
+    }
+    
+    int tw = wk.nf < (size_t)t ? (wk.nf ? (int)wk.nf : 1) : t;
+    run_workers(pool, tw, worker_tree, ws, sizeof(TreeWorker), NULL);
+    
+    int err = 0;
+    for (int i = 0; i < tw; i++) {
+        stats_add(ctx, i, &ws[i].stats);
+        err |= ws[i].err;
+    }
+    
+    TreeWorker *bw = &ws[t];
+    for (size_t i = 0; i < wk.nf && !err; i++) {
+        if (wk.fs[i].big) err = tree_big(pool, t, bw, &wk.fs[i], ctx) < 0;
+    }
+    if (bw->flags & FS_TREE_FIRST) stats_add(ctx, 0, &bw->stats);
+    
+    unsigned long long first = 0;
+    for (int i = 0; i <= t; i++) {
+        tr->skipped += ws[i].skipped;
+        if (ws[i].first && (!first || ws[i].first < first)) first = ws[i].first;
+    }
+    stats_first(ctx, first);
+    
+    long tot = 0;
+    int stop = 0;
+    for (size_t i = 0; i < wk.nf && !err; i++) {
+        TreeFile *f = &wk.fs[i];
+        if (f->w < 0) continue;
+        
+        tr->files++;
+        tr->bytes += f->size;
+        if (!f->n) continue;
+        
+        tr->matched++;
+        tot += f->n;
+        if (fn && !stop) stop = fn(wk.arena + f->path, ws[f->w].hits.v + f->at, f->n, arg) != 0;
+    }
+    
+    for (int i = 0; i <= t; i++) {
+        free(ws[i].buf);
+        free(ws[i].hits.v);
+    }
+    walk_free(&wk);
+    
+    ctx_end(ctx, NULL, NULL);
+    return err ? -1 : tot;
+}